@@ -0,0 +1,218 @@
+#include "accesslog.h"
+#include "log.h"
+
+static uint64_t wall_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static access_log *logs[MAX_ACCESS_LOGS]; // of this process
+static int log_count;
+static pthread_mutex_t logs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t keeper_once = PTHREAD_ONCE_INIT;
+static sem_t wake;              // a worker took its spare
+static cpu_set_t allowed;       // the keeper may run on any of them
+
+// path is renamed path.<microseconds>: old ones sort by time, the tool
+// read them in any order
+static void retire(char *path) {
+    char old[PATH_MAX + 64];
+    snprintf(old, sizeof(old), "%s.%llu", path,
+             (unsigned long long)wall_us());
+    if (rename(path, old)) {
+        LOGS(LOG_ERROR, strerror(errno), "rename access log: %s");
+    }
+}
+
+// prefix.worker.next, where the spare is made
+static void spare_name(access_log *log, char *buf) {
+    snprintf(buf, PATH_MAX + 32, "%s.next", log->name);
+}
+
+// a new file at path with its header, blocks reserved so a page fault
+// of the map does not allocate them. -1 if it can not
+static int make_file(access_log *log, char *path, int *fd, char **map) {
+    access_header *h;
+    *fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (*fd < 0 && errno == EEXIST) {
+        retire(path);           // left by the worker before a restart
+        *fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if (*fd < 0) {
+        return -1;
+    }
+    if (posix_fallocate(*fd, 0, ACCESS_FILE_SIZE) &&
+        ftruncate(*fd, ACCESS_FILE_SIZE)) {
+        close(*fd);
+        return -1;
+    }
+    *map = mmap(NULL, ACCESS_FILE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_SHARED, *fd, 0);
+    if (*map == MAP_FAILED) {
+        *map = NULL;
+        close(*fd);
+        return -1;
+    }
+    h = (access_header*)*map;
+    memcpy(h->magic, ACCESS_MAGIC, sizeof(h->magic));
+    h->version = ACCESS_VERSION;
+    h->record_size = sizeof(access_record);
+    h->worker = log->worker;
+    h->sample = log->sample;
+    h->start_us = wall_us();
+    return 0;
+}
+
+// keeper: the full file is cut to what is written and renamed, the
+// spare in use take the name
+static void retire_old(access_log *log) {
+    char spare[PATH_MAX + 32];
+    munmap(log->old_map, ACCESS_FILE_SIZE);
+    log->old_map = NULL;
+    if (ftruncate(log->old_fd, log->old_used)) {
+        LOGS(LOG_ERROR, strerror(errno), "ftruncate access log: %s");
+    }
+    close(log->old_fd);
+    retire(log->name);
+    spare_name(log, spare);
+    if (rename(spare, log->name)) {
+        LOGS(LOG_ERROR, strerror(errno), "rename access log: %s");
+    }
+}
+
+// one a process: whatever a worker left it, retire the full file and
+// make the next spare. Woken by a swap, a spare that failed is tried
+// again every ACCESS_RETRY_S
+static void* keeper(void *arg) {
+    char spare[PATH_MAX + 32];
+    struct timespec ts;
+    while (1) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ACCESS_RETRY_S;
+        sem_timedwait(&wake, &ts);
+        int count = __atomic_load_n(&log_count, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < count; i++) {
+            access_log *log = logs[i];
+            if (__atomic_load_n(&log->spare_ready, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            if (log->old_map) {
+                retire_old(log);
+            }
+            spare_name(log, spare);
+            if (make_file(log, spare, &log->spare_fd, &log->spare_map)) {
+                LOGS(LOG_ERROR, strerror(errno), "new access log: %s");
+                continue;
+            }
+            __atomic_store_n(&log->spare_ready, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static void start_keeper() {
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(allowed), &allowed);
+    if (pthread_create(&tid, &attr, keeper, NULL)) {
+        perror("pthread_create access log");
+        exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// before workers start and are pinned
+void access_init() {
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (sem_init(&wake, 0, 0)) {
+        perror("sem_init");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// log 1 in sample requests of worker to prefix.worker. -1 and off if
+// the file can not be made. Its spare is made by the keeper
+int access_open(access_log *log, char *prefix, int worker, int sample) {
+    memset(log, 0, sizeof(access_log));
+    snprintf(log->name, sizeof(log->name), "%s.%d", prefix, worker);
+    log->worker = worker;
+    log->sample = sample > 0 ? sample : 1;
+    if (make_file(log, log->name, &log->fd, &log->map)) {
+        return -1;
+    }
+    log->used = sizeof(access_header);
+    pthread_mutex_lock(&logs_lock);
+    if (log_count == MAX_ACCESS_LOGS) {
+        pthread_mutex_unlock(&logs_lock);
+        munmap(log->map, ACCESS_FILE_SIZE);
+        close(log->fd);
+        log->map = NULL;
+        errno = EMFILE;
+        return -1;
+    }
+    logs[log_count] = log;
+    __atomic_store_n(&log_count, log_count + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&logs_lock);
+    pthread_once(&keeper_once, start_keeper);
+    sem_post(&wake);
+    return 0;
+}
+
+// the active file is full: hand it to the keeper, use the spare it
+// made. A pointer swap and a sem_post. -1 if the spare is not made yet
+static int swap(access_log *log) {
+    if (!__atomic_load_n(&log->spare_ready, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    log->old_fd = log->fd;
+    log->old_map = log->map;
+    log->old_used = log->used;
+    log->fd = log->spare_fd;
+    log->map = log->spare_map;
+    log->used = sizeof(access_header);
+    ((access_header*)log->map)->start_us = wall_us();
+    log->rotations++;
+    __atomic_store_n(&log->spare_ready, 0, __ATOMIC_RELEASE);
+    sem_post(&wake);
+    return 0;
+}
+
+// at request start, as its path may not stay in the buffer till the
+// end. Sampled by count, time_us is 0 if not logged
+void access_begin(access_log *log, access_record *rec, uint32_t client,
+                  char *path, int len) {
+    rec->time_us = 0;
+    if (!log->map || ++log->seq % log->sample) {
+        return;
+    }
+    rec->time_us = 1;           // set at the end
+    rec->client = client;
+    if (len > ACCESS_PATH_LEN) {
+        len = ACCESS_PATH_LEN;
+    }
+    memcpy(rec->path, path, len);
+    memset(rec->path + len, 0, ACCESS_PATH_LEN - len);
+}
+
+// response is written, the record is appended. 1 if it is
+int access_end(access_log *log, access_record *rec, int route, int status,
+                uint32_t bytes, uint64_t latency_us) {
+    if (!rec->time_us || !log->map) {
+        return 0;
+    }
+    if (log->used + sizeof(access_record) > ACCESS_FILE_SIZE && swap(log)) {
+        return 0;               // the keeper is behind, not logged
+    }
+    rec->time_us = wall_us() - latency_us;
+    rec->latency_us = latency_us > UINT32_MAX ? UINT32_MAX : latency_us;
+    rec->bytes = bytes;
+    rec->status = status;
+    rec->route = route;
+    rec->worker = log->worker;
+    memcpy(log->map + log->used, rec, sizeof(access_record));
+    log->used += sizeof(access_record);
+    log->written++;
+    return 1;
+}
@@ -0,0 +1,78 @@
+#ifndef _ACCESSLOG_H_
+#define _ACCESSLOG_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACCESS_MAGIC "DICTACC1"
+#define ACCESS_VERSION 1
+#define ACCESS_FILE_SIZE (64 << 20) // a file hold about 1M requests, then rotate
+#define ACCESS_PATH_LEN 40
+#define ACCESS_RETRY_S 1        // a spare that could not be made is tried again
+#define MAX_ACCESS_LOGS 256     // workers of a process
+
+// start of every file
+typedef struct {
+    char magic[8];              // ACCESS_MAGIC
+    uint32_t version;
+    uint32_t record_size;       // sizeof(access_record)
+    uint32_t worker;
+    uint32_t sample;            // 1 in sample requests are in
+    uint64_t start_us;          // wall clock, file made
+    char pad[32];
+} access_header;
+
+// one request, 64 bytes, little endian as the host. time_us 0 is a
+// record not written, as the end of a file a crash left
+typedef struct {
+    uint64_t time_us;           // wall clock, request parsed
+    uint32_t client;            // IPv4, network order, 0 unknown
+    uint32_t latency_us;        // parsed to response written
+    uint32_t bytes;             // headers and body sent, error pages too
+    uint16_t status;
+    uint8_t route;              // ROUTE_* of stats.h
+    uint8_t worker;
+    char path[ACCESS_PATH_LEN]; // cut, \0 padded
+} access_record;
+
+// the file a worker append to. Zeroed is off. The next file is made,
+// and the full one cut and renamed, by a thread of the process: the
+// worker only swap them. spare_ready is 1 when spare_* is made and
+// old_* is taken, else it is the thread's turn
+typedef struct {
+    char name[PATH_MAX];        // prefix.worker
+    int fd;
+    char *map;                  // NULL if off
+    size_t used;
+    int worker, sample;
+    long seq;                   // requests seen, for sampling
+    long written, rotations;
+    int spare_ready;
+    int spare_fd, old_fd;
+    char *spare_map, *old_map;  // old_map NULL if none to retire
+    size_t old_used;
+} access_log;
+
+void access_init();
+
+int access_open(access_log *log, char *prefix, int worker, int sample);
+
+void access_begin(access_log *log, access_record *rec, uint32_t client,
+                  char *path, int len);
+
+int access_end(access_log *log, access_record *rec, int route, int status,
+               uint32_t bytes, uint64_t latency_us);
+
+#endif /* _ACCESSLOG_H_ */
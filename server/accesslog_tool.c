@@ -0,0 +1,227 @@
+// decode access log files of dict -A: accesslog-tool [options] files.
+// Records are printed one a line, or with -a added up by route, with
+// -n the most asked paths. Filters apply to both
+#include "accesslog.h"
+#include "stats.h"
+#include <arpa/inet.h>
+
+// filters, all must match
+static int route = -1, status = -1;
+static char *prefix;            // of path
+static uint32_t client;         // network order, 0 any
+static uint64_t from_us, to_us = UINT64_MAX;
+
+// -a
+typedef struct {
+    long requests;
+    double estimated;           // requests times sample of their file
+    long status_class[6];       // 1xx to 5xx, by status / 100
+    long bytes;
+    histogram latency;
+} route_total;
+
+static route_total totals[ROUTE_COUNT];
+
+// -n: count by path, open addressing, doubled when half full
+typedef struct {
+    char path[ACCESS_PATH_LEN + 1];
+    long count;
+} path_count;
+
+static path_count *paths;
+static size_t path_cap, path_used;
+
+static uint32_t hash_path(char *s) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
+}
+
+static path_count* path_slot(path_count *table, size_t cap, char *path) {
+    size_t i = hash_path(path) & (cap - 1);
+    while (table[i].count && strcmp(table[i].path, path)) {
+        i = (i + 1) & (cap - 1);
+    }
+    return table + i;
+}
+
+static void count_path(char *path) {
+    if (path_used * 2 >= path_cap) {
+        size_t cap = path_cap ? path_cap * 2 : 4096;
+        path_count *table = calloc(cap, sizeof(path_count));
+        if (!table) { perror("calloc"); exit(1); }
+        for (size_t i = 0; i < path_cap; i++) {
+            if (paths[i].count) {
+                *path_slot(table, cap, paths[i].path) = paths[i];
+            }
+        }
+        free(paths);
+        paths = table;
+        path_cap = cap;
+    }
+    path_count *p = path_slot(paths, path_cap, path);
+    if (!p->count) {
+        strcpy(p->path, path);
+        path_used++;
+    }
+    p->count++;
+}
+
+static int by_count(const void *a, const void *b) {
+    long x = ((path_count*)a)->count, y = ((path_count*)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int match(access_record *rec, char *path) {
+    return rec->time_us >= from_us && rec->time_us < to_us &&
+        (route < 0 || rec->route == route) &&
+        (status < 0 || rec->status == status || rec->status / 100 == status) &&
+        (!client || rec->client == client) &&
+        (!prefix || strncmp(path, prefix, strlen(prefix)) == 0);
+}
+
+static void print_record(access_record *rec, char *path) {
+    char date[32];
+    struct in_addr addr = { rec->client };
+    time_t sec = rec->time_us / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06ld %s %d %s %d %u %uus %s\n", date,
+           (long)(rec->time_us % 1000000), inet_ntoa(addr), rec->worker,
+           rec->route < ROUTE_COUNT ? route_names[rec->route] : "?",
+           rec->status, rec->bytes, rec->latency_us, path);
+}
+
+// records of one file. 0 if it is not an access log
+static int read_file(char *name, int aggregate, int top) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) { perror(name); exit(1); }
+    struct stat sbuf;
+    fstat(fd, &sbuf);
+    if (sbuf.st_size < (off_t)sizeof(access_header)) {
+        close(fd);
+        return 0;
+    }
+    char *data = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { perror("mmap"); exit(1); }
+    access_header *h = (access_header*)data;
+    if (memcmp(h->magic, ACCESS_MAGIC, sizeof(h->magic)) ||
+        h->version != ACCESS_VERSION || h->record_size != sizeof(access_record)) {
+        munmap(data, sbuf.st_size);
+        return 0;
+    }
+    madvise(data, sbuf.st_size, MADV_SEQUENTIAL);
+    access_record *rec = (access_record*)(data + sizeof(access_header));
+    size_t count = (sbuf.st_size - sizeof(access_header)) / sizeof(access_record);
+    for (size_t i = 0; i < count; i++, rec++) {
+        char path[ACCESS_PATH_LEN + 1];
+        if (!rec->time_us) {
+            break;              // rest not written, file of a running worker
+        }
+        memcpy(path, rec->path, ACCESS_PATH_LEN);
+        path[ACCESS_PATH_LEN] = '\0';
+        if (!match(rec, path)) {
+            continue;
+        }
+        if (top) {
+            count_path(path);
+        }
+        if (aggregate && rec->route < ROUTE_COUNT) {
+            route_total *t = totals + rec->route;
+            t->requests++;
+            t->estimated += h->sample;
+            t->status_class[rec->status / 100 % 6]++;
+            t->bytes += rec->bytes;
+            hist_record(&t->latency, rec->latency_us);
+        }
+        if (!aggregate && !top) {
+            print_record(rec, path);
+        }
+    }
+    munmap(data, sbuf.st_size);
+    return 1;
+}
+
+static void print_totals() {
+    printf("%-9s %10s %12s %8s %8s %8s %8s %12s %8s %8s %8s %8s\n",
+           "route", "requests", "estimated", "2xx", "3xx", "4xx", "5xx",
+           "bytes", "p50_us", "p90_us", "p99_us", "max_us");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        route_total *t = totals + r;
+        if (!t->requests) {
+            continue;
+        }
+        printf("%-9s %10ld %12.0f %8ld %8ld %8ld %8ld %12ld %8ld %8ld %8ld %8ld\n",
+               route_names[r], t->requests, t->estimated,
+               t->status_class[2], t->status_class[3], t->status_class[4],
+               t->status_class[5], t->bytes,
+               hist_percentile(&t->latency, 0.5),
+               hist_percentile(&t->latency, 0.9),
+               hist_percentile(&t->latency, 0.99), t->latency.max);
+    }
+}
+
+static void print_top(int top) {
+    size_t n = 0;
+    for (size_t i = 0; i < path_cap; i++) {
+        if (paths[i].count) {
+            paths[n++] = paths[i];
+        }
+    }
+    qsort(paths, n, sizeof(path_count), by_count);
+    for (size_t i = 0; i < n && i < (size_t)top; i++) {
+        printf("%10ld %s\n", paths[i].count, paths[i].path);
+    }
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-a] [-n top] [-r route] [-s status]"
+            " [-p path_prefix] [-c client_ip]\n"
+            "       [-f from_unix_time] [-t to_unix_time] file...\n"
+            "routes: entry complete suggest batch static stats."
+            " -s 4 is all 4xx\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    int opt, aggregate = 0, top = 0;
+    while ((opt = getopt(argc, argv, "an:r:s:p:c:f:t:")) != -1) {
+        switch (opt) {
+        case 'a': aggregate = 1; break;
+        case 'n': top = atoi(optarg); break;
+        case 'r':
+            for (int r = 0; r < ROUTE_COUNT; r++) {
+                if (strcmp(optarg, route_names[r]) == 0) {
+                    route = r;
+                }
+            }
+            if (route < 0) { usage(argv[0]); }
+            break;
+        case 's': status = atoi(optarg); break;
+        case 'p': prefix = optarg; break;
+        case 'c':
+            if (inet_pton(AF_INET, optarg, &client) != 1) { usage(argv[0]); }
+            break;
+        case 'f': from_us = atoll(optarg) * 1000000ULL; break;
+        case 't': to_us = atoll(optarg) * 1000000ULL; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind == argc) { usage(argv[0]); }
+    for (int i = optind; i < argc; i++) {
+        if (!read_file(argv[i], aggregate, top)) {
+            fprintf(stderr, "%s: not an access log\n", argv[i]);
+        }
+    }
+    if (aggregate) {
+        print_totals();
+    }
+    if (top) {
+        print_top(top);
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "complete.h"
+#include "dictdb.h"
+#include "log.h"
+
+#define MAX_PREFIX 256
+
+// a rank before b: more popular, then alphabetical
+static inline int better(int a, int b) {
+    uint32_t *freq = db->complete.freq;
+    return freq[a] > freq[b] || (freq[a] == freq[b] && a < b);
+}
+
+// result is sorted, keep at most n. Return new count
+static int rank_insert(int *result, int count, int n, int index) {
+    if (count == n && !better(index, result[n - 1])) {
+        return count;
+    }
+    int i = count < n ? count++ : n - 1;
+    while (i > 0 && better(index, result[i - 1])) {
+        result[i] = result[i - 1];
+        i--;
+    }
+    result[i] = index;
+    return count;
+}
+
+static int rank_range(int lo, int hi, int n, int *result) {
+    int count = 0;
+    for (int i = lo; i < hi; i++) {
+        count = rank_insert(result, count, n, i);
+    }
+    return count;
+}
+
+// -1 if out of memory, what is made so far stay for free_complete
+static int add_node(int lo, int hi) {
+    complete_data *c = &db->complete;
+    if (c->node_count == c->node_cap) {
+        int cap = c->node_cap ? c->node_cap * 2 : 1024;
+        prefix_node *nodes = realloc(c->nodes, sizeof(prefix_node) * cap);
+        if (!nodes) {
+            return -1;
+        }
+        c->nodes = nodes;
+        int *top_data = realloc(c->top_data, sizeof(int) * TOP_K * cap);
+        if (!top_data) {
+            return -1;
+        }
+        c->top_data = top_data;
+        c->node_cap = cap;
+    }
+    prefix_node *node = c->nodes + c->node_count;
+    node->lo = lo;
+    node->hi = hi;
+    node->top = c->node_count * TOP_K;
+    rank_range(lo, hi, TOP_K, c->top_data + node->top);
+    c->node_count++;
+    return 0;
+}
+
+// words in [lo, hi) share first depth bytes, split them by next byte.
+// Same range as parent means one child only, already added. -1 if out
+// of memory
+static int build_nodes(int lo, int hi, int depth, int parent_lo, int parent_hi) {
+    if (hi - lo <= SCAN_LIMIT) {
+        return 0;
+    }
+    if ((lo != parent_lo || hi != parent_hi) && add_node(lo, hi)) {
+        return -1;
+    }
+    int i = lo;
+    if (word_at(i)[depth] == '\0') { // the prefix itself, sorted first
+        i++;
+    }
+    while (i < hi) {
+        char c = word_at(i)[depth];
+        int j = i + 1;
+        while (j < hi && word_at(j)[depth] == c) {
+            j++;
+        }
+        if (build_nodes(i, j, depth + 1, lo, hi)) {
+            return -1;
+        }
+        i = j;
+    }
+    return 0;
+}
+
+static prefix_node* find_node(uint32_t lo, uint32_t hi) {
+    int low = 0, high = db->complete.node_count - 1;
+    while (low <= high) {
+        int mid = (low + high) >> 1;
+        prefix_node *node = db->complete.nodes + mid;
+        if (node->lo == lo && node->hi == hi) {
+            return node;
+        } else if (node->lo < lo || (node->lo == lo && node->hi > hi)) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+// lines of "word count", word may have space. -1 if it can not be read
+static int load_freq(char *freq_file) {
+    char line[MAX_PREFIX + 32];
+    int loaded = 0, total = word_total();
+    FILE *f = fopen(freq_file, "r");
+    if (!f) { perror(freq_file); return -1; }
+    while (fgets(line, sizeof(line), f)) {
+        char *sep = strrchr(line, ' ');
+        char *tab = strrchr(line, '\t');
+        if (tab > sep) { sep = tab; }
+        if (!sep) { continue; }
+        *sep = '\0';
+        int index = search_lower_bound(line);
+        if (index < total && strcmp(word_at(index), line) == 0) {
+            db->complete.freq[index] = strtoul(sep + 1, NULL, 10);
+            loaded++;
+        }
+    }
+    fclose(f);
+    LOGS(LOG_INFO, freq_file, "%s: %ld word frequencies", loaded);
+    return 0;
+}
+
+// freq_file is optional, without it completions are alphabetical.
+// Into db of the calling thread, -1 if freq_file can not be read or
+// out of memory. What is made is freed by free_complete
+int init_complete(char *freq_file) {
+    complete_data *c = &db->complete;
+    int total = word_total();
+    c->freq = calloc(total, sizeof(uint32_t));
+    if (!c->freq) {
+        perror("calloc");
+        return -1;
+    }
+    if (freq_file && load_freq(freq_file)) {
+        return -1;
+    }
+    if (build_nodes(0, total, 0, -1, -1)) {
+        perror("realloc");
+        return -1;
+    }
+    LOG(LOG_DEBUG, "%ld prefix nodes, %ld bytes", c->node_count,
+        c->node_count * (sizeof(prefix_node) + sizeof(int) * TOP_K));
+    return 0;
+}
+
+void free_complete(complete_data *c) {
+    free(c->freq);
+    free(c->nodes);
+    free(c->top_data);
+}
+
+uint32_t word_freq(int index) {
+    return db->complete.freq[index];
+}
+
+// best n words start with prefix, their indexes are put in result.
+// Return how many
+int complete(char *prefix, int n, int *result) {
+    char key[MAX_PREFIX + 2];
+    int length = strlen(prefix);
+    if (n > TOP_K) { n = TOP_K; }
+    if (n < 1 || length > MAX_PREFIX) { return 0; }
+    memcpy(key, prefix, length);
+    key[length] = '\xff';       // after all words with the prefix
+    key[length + 1] = '\0';
+    int lo = search_lower_bound(prefix);
+    int hi = search_lower_bound(key);
+    if (hi - lo > SCAN_LIMIT) {
+        prefix_node *node = find_node(lo, hi);
+        if (node) {
+            memcpy(result, db->complete.top_data + node->top, sizeof(int) * n);
+            return n;
+        }
+    }
+    return rank_range(lo, hi, n, result);
+}
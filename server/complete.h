@@ -0,0 +1,36 @@
+#ifndef _COMPLETE_H_
+#define _COMPLETE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "search.h"
+
+#define SCAN_LIMIT 64           // prefix with more words is precomputed
+#define TOP_K 32                // max completions returned
+
+// words with a prefix are a range of the sorted words. For a range
+// too big to rank at request time, its best TOP_K are kept
+typedef struct {
+    uint32_t lo, hi;            // [lo, hi) of word index
+    uint32_t top;               // offset of TOP_K indexes in top_data
+} prefix_node;
+
+// of a dict_db
+typedef struct {
+    uint32_t *freq;             // popularity of every word, 0 if unknown
+    prefix_node *nodes;         // by lo asc, then hi desc
+    int node_count, node_cap;
+    int *top_data;              // TOP_K word indexes per node
+} complete_data;
+
+int init_complete(char *freq_file);
+
+void free_complete(complete_data *c);
+
+uint32_t word_freq(int index);
+
+int complete(char *prefix, int n, int *result);
+
+#endif /* _COMPLETE_H_ */
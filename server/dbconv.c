@@ -0,0 +1,200 @@
+// convert v1 or v2 dbdata to v3: dbconv <in file> <v3 file>. Every
+// entry gets identity, gzip, br and, with HAVE_ZSTD, zstd variants.
+// A compressed variant not smaller than identity is left out
+#include "search.h"
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static FILE *out;
+static uint32_t offset;         // where next byte written is
+
+static void write_all(void *buf, size_t n) {
+    if (fwrite(buf, 1, n, out) != n) {
+        perror("fwrite");
+        exit(1);
+    }
+    offset += n;
+}
+
+// stored gzip variant is raw deflate, crc32 and size
+static uLong inflate_gzip(char *data, int size, char *buf, uLong cap) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    inflateInit2(&z, -MAX_WBITS);
+    z.next_in = (Bytef*)data;
+    z.avail_in = size;
+    z.next_out = (Bytef*)buf;
+    z.avail_out = cap;
+    if (inflate(&z, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "broken gzip entry\n");
+        exit(1);
+    }
+    inflateEnd(&z);
+    return z.total_out;
+}
+
+static uLong deflate_gzip(char *json, int size, char *buf, uLong cap) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 9,
+                 Z_DEFAULT_STRATEGY);
+    z.next_in = (Bytef*)json;
+    z.avail_in = size;
+    z.next_out = (Bytef*)buf;
+    z.avail_out = cap - 8;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "deflate failed\n");
+        exit(1);
+    }
+    deflateEnd(&z);
+    uint32_t trailer[2] = { crc32(0, (Bytef*)json, size), size }; // little-endian
+    memcpy(buf + z.total_out, trailer, 8);
+    return z.total_out + 8;
+}
+
+static void write_variant(int encoding, char *data, uint32_t size) {
+    uint8_t enc = encoding;
+    write_all(&enc, 1);
+    write_all(&size, 4);
+    write_all(data, size);
+}
+
+// json of one word, gzip is the stored variant or NULL
+static void convert(char *word, char *json, int size, char *gzip, int gzip_size) {
+    static char buf[1 << 24];
+    char *variants[ENC_COUNT];
+    size_t sizes[ENC_COUNT];
+    int count = 1;
+    variants[ENC_IDENTITY] = json;
+    sizes[ENC_IDENTITY] = size;
+    if (!gzip) {
+        gzip = buf;
+        gzip_size = deflate_gzip(json, size, buf, sizeof(buf));
+    }
+    variants[ENC_GZIP] = gzip;
+    sizes[ENC_GZIP] = gzip_size;
+    variants[ENC_BR] = variants[ENC_ZSTD] = NULL;
+    char *p = gzip == buf ? buf + gzip_size : buf;
+#ifdef HAVE_BROTLI
+    sizes[ENC_BR] = buf + sizeof(buf) - p;
+    if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+                              BROTLI_MODE_TEXT, size, (uint8_t*)json,
+                              sizes + ENC_BR, (uint8_t*)p)) {
+        variants[ENC_BR] = p;
+        p += sizes[ENC_BR];
+    }
+#endif
+#ifdef HAVE_ZSTD
+    sizes[ENC_ZSTD] = ZSTD_compress(p, buf + sizeof(buf) - p, json, size, 19);
+    if (!ZSTD_isError(sizes[ENC_ZSTD])) {
+        variants[ENC_ZSTD] = p;
+    }
+#endif
+    for (int enc = ENC_GZIP; enc < ENC_COUNT; enc++) {
+        if (variants[enc] && sizes[enc] >= size) {
+            variants[enc] = NULL; // no gain
+        }
+        count += variants[enc] != NULL;
+    }
+    uint8_t n = count;
+    write_all(word, strlen(word) + 1);
+    write_all(&n, 1);
+    for (int enc = 0; enc < ENC_COUNT; enc++) {
+        if (variants[enc]) {
+            write_variant(enc, variants[enc], sizes[enc]);
+        }
+    }
+}
+
+// stored as gzip or as json, hand json to convert
+static void convert_stored(char *word, char *data, int size, int gzipped) {
+    static char json[1 << 24];
+    if (gzipped) {
+        int length = inflate_gzip(data, size, json, sizeof(json));
+        convert(word, json, length, data, size);
+    } else {
+        convert(word, data, size, NULL, 0);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <v1 or v2 dbdata> <v3 dbdata>\n", argv[0]);
+        exit(1);
+    }
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) { perror(argv[1]); exit(1); }
+    struct stat sbuf;
+    fstat(fd, &sbuf);
+    char *data = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) { perror("mmap"); exit(1); }
+    db_header *in = (db_header*)data;
+    int version = memcmp(in->magic, DB_MAGIC, 6) ? 1 : in->version;
+    if (version != 1 && version != 2) {
+        fprintf(stderr, "%s: can not convert version %d\n", argv[1], version);
+        exit(1);
+    }
+
+    out = fopen(argv[2], "w");
+    if (!out) { perror(argv[2]); exit(1); }
+    db_header header;
+    memset(&header, 0, sizeof(header));
+    write_all(&header, sizeof(header)); // fill later
+
+    size_t cap = 65536;
+    uint32_t count = 0, *offsets = malloc(sizeof(uint32_t) * cap);
+    if (version == 2) {
+        uint32_t *index = (uint32_t*)(data + in->index_offset);
+        for (uint32_t i = 0; i < in->word_count; i++) {
+            char *word = data + index[i];
+            char *loc = word + strlen(word) + 1;
+            uint32_t size;
+            memcpy(&size, loc + 1, 4);
+            if (count == cap) {
+                cap *= 2;
+                offsets = realloc(offsets, sizeof(uint32_t) * cap);
+            }
+            offsets[count++] = offset;
+            convert_stored(word, loc + 5, size, loc[0] & DB_GZIPPED);
+        }
+    } else {
+        // v1 count is 2 byte, may wrap, count by walking
+        off_t index = 2;        // ignore first 2 byte, that's word count
+        while (index < sbuf.st_size) {
+            char *word = data + index;
+            index += strlen(word) + 1;
+            int size = ((unsigned char)data[index] << 8) // big-endian
+                | (unsigned char)data[index + 1];
+            int gzipped = 1;
+            if (size >= 0xe000) { // first bit: is not gzipped
+                size -= 0xe000;
+                gzipped = 0;
+            }
+            if (count == cap) {
+                cap *= 2;
+                offsets = realloc(offsets, sizeof(uint32_t) * cap);
+            }
+            offsets[count++] = offset;
+            convert_stored(word, data + index + 2, size, gzipped);
+            index += size + 2;
+        }
+    }
+    uint32_t pad = 0, padding = (4 - offset % 4) % 4; // align the index
+    write_all(&pad, padding);
+    header.index_offset = offset;
+    write_all(offsets, sizeof(uint32_t) * count);
+
+    memcpy(header.magic, DB_MAGIC, sizeof(header.magic));
+    header.version = DB_VERSION;
+    header.word_count = count;
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, 1, sizeof(header), out);
+    fclose(out);
+    printf("%u words, %u bytes\n", count, offset);
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "dictdb.h"
+#include "log.h"
+
+__thread dict_db *db;
+
+static dict_db *published;      // newest, what db_enter take
+static uint64_t generations;
+static int max_words;           // of all made, stamps of suggest are this many
+static int index_type;          // of init, kept for reloads
+static char *freq_file;
+static long reload_failed;
+static int retiring;            // an old one wait for its grace period
+static sem_t reload_sem;        // posted by SIGHUP
+static cpu_set_t allowed;       // the reloader may run on any of them
+
+// generation each worker is in an event with, 0 between events
+static db_slot slots[DB_MAX_WORKERS];
+static int slot_count;
+static __thread int slot = -1;
+static pthread_once_t reloader_once = PTHREAD_ONCE_INIT;
+
+static void free_db(dict_db *d) {
+    free_dict_search(&d->search);
+    free_responses(&d->response);
+    free_complete(&d->complete);
+    free_suggest(&d->suggest);
+    free(d);
+}
+
+// map FILENAME, make all of it. The calling thread's db point to it
+// while it is made. NULL if the file is missing or broken
+static dict_db* build_db() {
+    dict_db *d = calloc(1, sizeof(dict_db));
+    if (!d) {
+        return NULL;
+    }
+    db = d;
+    if (init_dict_search(index_type)) {
+        free_db(d);
+        return NULL;
+    }
+    if (init_responses() || init_complete(freq_file) || init_suggest()) {
+        free_db(d);
+        return NULL;
+    }
+    d->generation = ++generations;
+    if (d->search.word_count > max_words) {
+        __atomic_store_n(&max_words, d->search.word_count, __ATOMIC_RELEASE);
+    }
+    return d;
+}
+
+// the first one, exit if it can not be made
+void db_init(int type, char *freq) {
+    index_type = type;
+    freq_file = freq;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (sem_init(&reload_sem, 0, 0)) {
+        perror("sem_init");
+        exit(EXIT_FAILURE);
+    }
+    if (!(published = build_db())) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+// no worker is in an event with old, or has a response from it
+static int unused(dict_db *old) {
+    for (int i = 0; i < __atomic_load_n(&slot_count, __ATOMIC_ACQUIRE); i++) {
+        uint64_t g = __atomic_load_n(&slots[i].value, __ATOMIC_SEQ_CST);
+        if ((g && g <= old->generation) ||
+            __atomic_load_n(&old->users[i].value, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// make the new one, publish it, wait till the old one is unused and
+// free it. Workers never wait for any of it
+static void* reloader(void *arg) {
+    struct timespec nap = { 0, DB_GRACE_MS * 1000000L };
+    while (1) {
+        while (sem_wait(&reload_sem) && errno == EINTR) {
+        }
+        dict_db *old = published, *fresh = build_db();
+        if (!fresh) {
+            reload_failed++;
+            LOG(LOG_ERROR, "reload failed, generation %ld is kept",
+                old->generation);
+            continue;
+        }
+        __atomic_store_n(&published, fresh, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&retiring, 1, __ATOMIC_RELAXED);
+        LOG(LOG_INFO, "generation %ld, %ld words, is in use",
+            fresh->generation, fresh->search.word_count);
+        while (!unused(old)) {
+            nanosleep(&nap, NULL);
+        }
+        LOG(LOG_INFO, "generation %ld is freed", old->generation);
+        free_db(old);
+        __atomic_store_n(&retiring, 0, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// one a process, not on the core of a worker
+static void start_reloader() {
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(allowed), &allowed);
+    if (pthread_create(&tid, &attr, reloader, NULL)) {
+        perror("pthread_create reloader");
+        exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// the calling worker get a slot, and what it need for requests
+void db_attach() {
+    slot = __atomic_fetch_add(&slot_count, 1, __ATOMIC_ACQ_REL);
+    if (slot >= DB_MAX_WORKERS) {
+        fprintf(stderr, "more than %d workers\n", DB_MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+    if (suggest_reserve(__atomic_load_n(&max_words, __ATOMIC_ACQUIRE))) {
+        perror("suggest_reserve");
+        exit(EXIT_FAILURE);
+    }
+    pthread_once(&reloader_once, start_reloader);
+}
+
+// after a wait: take the newest. The slot is set before published is
+// read again, so the reloader see it, or we see the new one
+void db_enter() {
+    dict_db *d;
+    do {
+        d = __atomic_load_n(&published, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&slots[slot].value, d->generation, __ATOMIC_SEQ_CST);
+    } while (d != __atomic_load_n(&published, __ATOMIC_SEQ_CST));
+    if (d != db &&
+        suggest_reserve(__atomic_load_n(&max_words, __ATOMIC_ACQUIRE))) {
+        // once a reload, not in a request. /s/ answer none till it fit
+        LOG(LOG_ERROR, "no memory for suggest of %ld words",
+            d->search.word_count);
+    }
+    db = d;
+}
+
+// before a wait: db is not used till next db_enter
+void db_leave() {
+    __atomic_store_n(&slots[slot].value, 0, __ATOMIC_RELEASE);
+}
+
+// a response is made of db, keep it till db_drop
+dict_db* db_hold() {
+    db_slot *u = db->users + slot;
+    __atomic_store_n(&u->value, u->value + 1, __ATOMIC_RELAXED);
+    return db;
+}
+
+void db_drop(dict_db *d) {
+    db_slot *u = d->users + slot;
+    __atomic_store_n(&u->value, u->value - 1, __ATOMIC_RELEASE);
+}
+
+// async signal safe
+void db_reload() {
+    sem_post(&reload_sem);
+}
+
+void db_status(uint64_t *generation, long *failed, int *waiting) {
+    *generation = __atomic_load_n(&published, __ATOMIC_ACQUIRE)->generation;
+    *failed = __atomic_load_n(&reload_failed, __ATOMIC_RELAXED);
+    *waiting = __atomic_load_n(&retiring, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,55 @@
+#ifndef _DICTDB_H_
+#define _DICTDB_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "complete.h"
+#include "response.h"
+#include "search.h"
+#include "suggest.h"
+
+#define DB_MAX_WORKERS 256      // threads of a process using it
+#define DB_GRACE_MS 10          // how often a retired one is checked
+
+// of one worker, written only by it. A cache line each
+typedef struct {
+    uint64_t value;
+    char pad[56];
+} db_slot;
+
+// a dbdata and all made of it: indexes, responses, completions,
+// suggestions. Read only once published. Workers take the newest at
+// every wake up; a replaced one is freed once no worker is in an event
+// with it and no response in flight point into it
+typedef struct {
+    search_data search;
+    response_data response;
+    complete_data complete;
+    suggest_data suggest;
+    uint64_t generation;        // 1 is the one made at start
+    db_slot users[DB_MAX_WORKERS]; // responses in flight, by worker
+} dict_db;
+
+extern __thread dict_db *db;    // what the calling thread use
+
+void db_init(int index_type, char *freq_file);
+
+void db_attach();
+
+void db_enter();
+
+void db_leave();
+
+dict_db* db_hold();
+
+void db_drop(dict_db *d);
+
+void db_reload();
+
+void db_status(uint64_t *generation, long *failed, int *retiring);
+
+#endif /* _DICTDB_H_ */
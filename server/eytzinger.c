@@ -0,0 +1,108 @@
+#include "eytzinger.h"
+#include "resident.h"
+
+static void make_key(char *word, uint64_t *hi, uint32_t *lo) {
+    unsigned char buf[KEY_PREFIX] = { 0 };
+    for (int i = 0; i < KEY_PREFIX && word[i]; i++) {
+        buf[i] = word[i];
+    }
+    *hi = 0;
+    *lo = 0;
+    for (int i = 0; i < 8; i++) {
+        *hi = (*hi << 8) | buf[i];
+    }
+    for (int i = 8; i < KEY_PREFIX; i++) {
+        *lo = (*lo << 8) | buf[i];
+    }
+}
+
+// in-order walk of the tree visit words in sorted order
+static int fill(eytzinger_index *e, int i, int k) {
+    if (k <= e->count) {
+        i = fill(e, i, 2 * k);
+        eytzinger_node *n = e->nodes + k;
+        make_key(e->data + e->offsets[i], &n->hi, &n->lo);
+        n->index = i++;
+        i = fill(e, i, 2 * k + 1);
+    }
+    return i;
+}
+
+// -1 if out of memory
+int eytzinger_build(eytzinger_index *e, char *data, uint32_t *offsets, int count) {
+    e->count = count;
+    e->data = data;
+    e->offsets = offsets;
+    // 64 byte aligned: grandchildren 4k..4k+3 share one cache line
+    if (!(e->nodes = resident_alloc(sizeof(eytzinger_node) * (count + 1)))) {
+        perror("resident_alloc");
+        return -1;
+    }
+    fill(e, 0, 1);
+    return 0;
+}
+
+// word of node < target. Most of the time decided by the prefix
+static inline int node_less(eytzinger_index *e, eytzinger_node *n,
+                            uint64_t hi, uint32_t lo, char *target) {
+    if (n->hi != hi) {
+        return n->hi < hi;
+    }
+    if (n->lo != lo) {
+        return n->lo < lo;
+    }
+    if ((lo & 0xff) == 0) {     // both end inside prefix, equal
+        return 0;
+    }
+    char *word = e->data + e->offsets[n->index];
+    return strcmp(word + KEY_PREFIX, target + KEY_PREFIX) < 0;
+}
+
+// index of first word >= target, count if all words are less
+int eytzinger_lower_bound(eytzinger_index *e, char *target) {
+    uint64_t hi;
+    uint32_t lo;
+    make_key(target, &hi, &lo);
+    eytzinger_node *nodes = e->nodes;
+    unsigned int k = 1;
+    while (k <= e->count) {
+        __builtin_prefetch(nodes + 4 * k);
+        k = 2 * k + node_less(e, nodes + k, hi, lo, target);
+    }
+    k >>= __builtin_ffs(~k);    // cancel the right turns
+    return k ? nodes[k].index : e->count;
+}
+
+// eytzinger_lower_bound for many words, walk down the tree side by side.
+// All paths are as deep, or one level less
+void eytzinger_lower_bound_batch(eytzinger_index *e, char **targets, int count,
+                                 int *result) {
+    uint64_t his[EYTZINGER_GROUP];
+    uint32_t los[EYTZINGER_GROUP];
+    unsigned int ks[EYTZINGER_GROUP];
+    eytzinger_node *nodes = e->nodes;
+    for (int base = 0; base < count; base += EYTZINGER_GROUP) {
+        int n = count - base < EYTZINGER_GROUP ? count - base : EYTZINGER_GROUP;
+        for (int i = 0; i < n; i++) {
+            make_key(targets[base + i], his + i, los + i);
+            ks[i] = 1;
+        }
+        int active = n;
+        while (active) {
+            active = 0;
+            for (int i = 0; i < n; i++) {
+                unsigned int k = ks[i];
+                if (k <= e->count) {
+                    __builtin_prefetch(nodes + 4 * k);
+                    ks[i] = 2 * k + node_less(e, nodes + k, his[i], los[i],
+                                              targets[base + i]);
+                    active++;
+                }
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            unsigned int k = ks[i] >> __builtin_ffs(~ks[i]);
+            result[base + i] = k ? nodes[k].index : e->count;
+        }
+    }
+}
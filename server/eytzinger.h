@@ -0,0 +1,37 @@
+#ifndef _EYTZINGER_H_
+#define _EYTZINGER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_PREFIX 12           // bytes of word inline in node
+#define EYTZINGER_GROUP 16      // words walk down side by side
+
+// first 12 bytes of word, big-endian, zero padded: integer compare is
+// strcmp order. 4 nodes in a cache line
+typedef struct {
+    uint64_t hi;                // byte 0 - 7
+    uint32_t lo;                // byte 8 - 11
+    int32_t index;              // word index in sorted order
+} eytzinger_node;
+
+// sorted words in BFS order of a complete binary tree, node k has
+// children 2k and 2k+1, 1 based. Top levels stay in cache, children of
+// a node are fetched before they are needed
+typedef struct {
+    int count;
+    eytzinger_node *nodes;      // count + 1, nodes[0] unused
+    char *data;                 // words are data + offsets[index]
+    uint32_t *offsets;
+} eytzinger_index;
+
+int eytzinger_build(eytzinger_index *e, char *data, uint32_t *offsets, int count);
+
+int eytzinger_lower_bound(eytzinger_index *e, char *target);
+
+void eytzinger_lower_bound_batch(eytzinger_index *e, char **targets, int count,
+                                 int *result);
+
+#endif /* _EYTZINGER_H_ */
@@ -0,0 +1,107 @@
+#include "hash.h"
+#include "resident.h"
+
+// FNV-1a, 64 bit. Low bits pick slot, high bits are fingerprint
+static uint64_t hash_word(char *word) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*word) {
+        h ^= (unsigned char)*word++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// FNV-1a of n bytes, for content fingerprints
+uint64_t hash_bytes(const void *data, size_t n) {
+    const unsigned char *p = data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// -1 if out of memory
+int hash_build(hash_index *h, char *data, uint32_t *offsets, int count) {
+    uint32_t size = 1;
+    while (size < (uint32_t)count * 2) { size <<= 1; }
+    h->mask = size - 1;
+    h->data = data;
+    h->offsets = offsets;
+    if (!(h->slots = resident_alloc(sizeof(hash_slot) * size))) {
+        perror("resident_alloc");
+        return -1;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        h->slots[i].index = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        uint64_t hv = hash_word(data + offsets[i]);
+        uint32_t slot = hv & h->mask;
+        while (h->slots[slot].index >= 0) {
+            slot = (slot + 1) & h->mask;
+        }
+        h->slots[slot].fingerprint = hv >> 32;
+        h->slots[slot].index = i;
+    }
+    return 0;
+}
+
+// return index of the word, or -1. One slot line, one strcmp on a hit
+int hash_lookup(hash_index *h, char *target) {
+    uint64_t hv = hash_word(target);
+    uint32_t fingerprint = hv >> 32, slot = hv & h->mask;
+    hash_slot *s;
+    while ((s = h->slots + slot)->index >= 0) {
+        if (s->fingerprint == fingerprint &&
+            strcmp(target, h->data + h->offsets[s->index]) == 0) {
+            return s->index;
+        }
+        slot = (slot + 1) & h->mask;
+    }
+    return -1;
+}
+
+// hash_lookup for many words, each step done for all before the next,
+// so cache misses of different words overlap
+void hash_lookup_batch(hash_index *h, char **targets, int count, int *result) {
+    uint32_t fingerprints[HASH_GROUP], slots[HASH_GROUP];
+    for (int base = 0; base < count; base += HASH_GROUP) {
+        int n = count - base < HASH_GROUP ? count - base : HASH_GROUP;
+        for (int i = 0; i < n; i++) {
+            uint64_t hv = hash_word(targets[base + i]);
+            fingerprints[i] = hv >> 32;
+            slots[i] = hv & h->mask;
+            __builtin_prefetch(h->slots + slots[i]);
+        }
+        for (int i = 0; i < n; i++) { // first slot with same fingerprint
+            hash_slot *s;
+            while ((s = h->slots + slots[i])->index >= 0 &&
+                   s->fingerprint != fingerprints[i]) {
+                slots[i] = (slots[i] + 1) & h->mask;
+            }
+            if (s->index >= 0) {
+                __builtin_prefetch(h->offsets + s->index);
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            int index = h->slots[slots[i]].index;
+            if (index >= 0) {
+                __builtin_prefetch(h->data + h->offsets[index]);
+            }
+        }
+        for (int i = 0; i < n; i++) { // mostly one strcmp
+            hash_slot *s;
+            result[base + i] = -1;
+            while ((s = h->slots + slots[i])->index >= 0) {
+                if (s->fingerprint == fingerprints[i] &&
+                    strcmp(targets[base + i], h->data + h->offsets[s->index]) == 0) {
+                    result[base + i] = s->index;
+                    break;
+                }
+                slots[i] = (slots[i] + 1) & h->mask;
+            }
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ETAG_LEN 18             // hash_bytes in hex, quoted
+#define HASH_GROUP 16          // words looked up side by side
+
+typedef struct {
+    uint32_t fingerprint;       // high 32 bit of hash, skip most strcmp
+    int32_t index;              // word index, -1 is empty
+} hash_slot;
+
+// open addressing, linear probe, at most half full
+typedef struct {
+    uint32_t mask;              // slot count - 1
+    hash_slot *slots;
+    char *data;                 // words are data + offsets[index]
+    uint32_t *offsets;
+} hash_index;
+
+uint64_t hash_bytes(const void *data, size_t n);
+
+int hash_build(hash_index *h, char *data, uint32_t *offsets, int count);
+
+int hash_lookup(hash_index *h, char *target);
+
+void hash_lookup_batch(hash_index *h, char **targets, int count, int *result);
+
+#endif /* _HASH_H_ */
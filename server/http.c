@@ -0,0 +1,315 @@
+#include "http.h"
+#include "network.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PARSE_LINE 0            // waiting for request line
+#define PARSE_HEADERS 1         // waiting for header lines
+#define PARSE_DONE 2            // blank line seen
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+// first \n in [p, end), 16 or 8 bytes a time
+static char* find_lf(char *p, char *end) {
+#ifdef __SSE2__
+    __m128i lf = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - p >= 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        x ^= '\n' * ONES;       // byte is 0 where it was \n
+        uint64_t zero = (x - ONES) & ~x & HIGHS;
+        if (zero) {
+            return p + (__builtin_ctzll(zero) >> 3);
+        }
+        p += 8;
+    }
+#endif
+    while (p < end) {
+        if (*p == '\n') {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// Connection: token list, close wins
+static void parse_connection(http_request *req, char *v, int len) {
+    char *end = v + len;
+    while (v < end) {
+        while (v < end && (*v == ' ' || *v == ',')) { v++; }
+        char *t = v;
+        while (v < end && *v != ',' && *v != ' ') { v++; }
+        if (v - t == 5 && strncasecmp(t, "close", 5) == 0) {
+            req->keep_alive = 0;
+            return;
+        } else if (v - t == 10 && strncasecmp(t, "keep-alive", 10) == 0) {
+            req->keep_alive = 1;
+        }
+    }
+}
+
+// gzip, br;q=1.0, zstd;q=0, *. Coding with q=0 is not accepted
+static void parse_accept_encoding(http_request *req, char *v, int len) {
+    char *end = v + len;
+    while (v < end) {
+        while (v < end && (*v == ' ' || *v == ',')) { v++; }
+        char *t = v;
+        while (v < end && *v != ',' && *v != ';' && *v != ' ') { v++; }
+        int t_len = v - t, bits = 0;
+        if (t_len == 4 && strncasecmp(t, "gzip", 4) == 0) {
+            bits = ACCEPT_GZIP;
+        } else if (t_len == 2 && strncasecmp(t, "br", 2) == 0) {
+            bits = ACCEPT_BR;
+        } else if (t_len == 4 && strncasecmp(t, "zstd", 4) == 0) {
+            bits = ACCEPT_ZSTD;
+        } else if (t_len == 1 && *t == '*') {
+            bits = ACCEPT_GZIP | ACCEPT_BR | ACCEPT_ZSTD;
+        }
+        char *param = v;
+        while (v < end && *v != ',') { v++; }
+        char *q = memchr(param, 'q', v - param); // ;q=0, ;q=0.000
+        if (q && q + 2 < v && q[1] == '=' && q[2] == '0') {
+            char *d = q + 3;
+            if (d < v && *d == '.') { d++; }
+            while (d < v && *d == '0') { d++; }
+            if (d == v || *d == ' ') {
+                bits = 0;
+            }
+        }
+        req->accept_enc |= bits;
+    }
+}
+
+// IMF-fixdate only: Sun, 06 Nov 1994 08:49:37 GMT
+static time_t parse_http_date(char *v, int len) {
+    char date[64];
+    struct tm tm;
+    if (len >= sizeof(date)) {
+        return 0;
+    }
+    memcpy(date, v, len);
+    date[len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return end && *end == '\0' ? timegm(&tm) : 0;
+}
+
+static void parse_header(http_request *req, char *line, int len) {
+    char *colon = memchr(line, ':', len);
+    if (!colon) {
+        return;                 // ignore malformed header
+    }
+    int name_len = colon - line;
+    char *v = colon + 1;
+    int v_len = len - name_len - 1;
+    while (v_len && *v == ' ') { v++; v_len--; }
+    if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+        parse_connection(req, v, v_len);
+    } else if (name_len == 15 && strncasecmp(line, "Accept-Encoding", 15) == 0) {
+        parse_accept_encoding(req, v, v_len);
+    } else if (name_len == 13 && strncasecmp(line, "If-None-Match", 13) == 0) {
+        while (v_len && v[v_len - 1] == ' ') { v_len--; }
+        req->inm_off = v - req->buf;
+        req->inm_len = v_len;
+    } else if (name_len == 17 && strncasecmp(line, "If-Modified-Since", 17) == 0) {
+        req->if_modified_since = parse_http_date(v, v_len);
+    }
+}
+
+// METHOD SP PATH SP HTTP/1.x, method and path are \0 terminated in place
+static int parse_request_line(http_request *req, char *line, int len) {
+    char *end = line + len;
+    char *sp1 = memchr(line, ' ', len);
+    if (!sp1) { return HTTP_ERROR; }
+    char *path = sp1 + 1;
+    char *sp2 = memchr(path, ' ', end - path);
+    if (!sp2 || end - sp2 != 9 || memcmp(sp2 + 1, "HTTP/1.", 7)) {
+        return HTTP_ERROR;
+    }
+    req->http_minor = sp2[8] - '0';
+    req->keep_alive = req->http_minor > 0;
+    req->accept_enc = ACCEPT_IDENTITY;
+    req->inm_len = 0;
+    req->if_modified_since = 0;
+    *sp1 = '\0';
+    *sp2 = '\0';
+    req->method_off = line - req->buf;
+    req->method_len = sp1 - line;
+    char *path_end = sp2, *query = memchr(path, '?', sp2 - path);
+    if (query) {
+        path_end = query;
+        *query++ = '\0';
+        req->query_off = query - req->buf;
+        req->query_len = url_decode(query, sp2 - query);
+    } else {
+        req->query_off = sp2 - req->buf; // empty string
+        req->query_len = 0;
+    }
+    req->path_off = path - req->buf;
+    req->path_len = url_decode(path, path_end - path);
+    return 0;
+}
+
+void http_init(http_request *req) {
+    req->state = PARSE_LINE;
+    req->start = req->line = req->scan = req->cnt = 0;
+}
+
+// move current request to front, room for more after it
+static void http_compact(http_request *req) {
+    int shift = req->start;
+    if (shift) {
+        memmove(req->buf, req->buf + shift, req->cnt - shift);
+        req->cnt -= shift;
+        req->start = 0;
+        req->line -= shift;
+        req->scan -= shift;
+        req->method_off -= shift;
+        req->path_off -= shift;
+        req->query_off -= shift;
+        req->inm_off -= shift;
+    }
+}
+
+// read all that a non-blocking fd has, after unparsed bytes.
+// Return 1, 0 on EOF, -1 on error
+int http_fill(http_request *req, int fd) {
+    int n;
+    http_compact(req);
+    while (req->cnt < REQ_BUFSIZE) {
+        n = read(fd, req->buf + req->cnt, REQ_BUFSIZE - req->cnt);
+        if (n > 0) {
+            req->cnt += n;
+        } else if (n == 0) {
+            return 0;           // EOF
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;              // all read
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// n bytes already read, as by io_uring, after unparsed bytes. Return
+// how many are taken, less than n if buffer is full
+int http_feed(http_request *req, char *data, int n) {
+    http_compact(req);
+    if (n > REQ_BUFSIZE - req->cnt) {
+        n = REQ_BUFSIZE - req->cnt;
+    }
+    memcpy(req->buf + req->cnt, data, n);
+    req->cnt += n;
+    return n;
+}
+
+// resume from where last call stopped, never rescan a byte
+int http_parse(http_request *req) {
+    char *buf = req->buf, *end = buf + req->cnt, *lf;
+    if (req->state == PARSE_DONE) {
+        return HTTP_DONE;
+    }
+    while ((lf = find_lf(buf + req->scan, end))) {
+        char *line = buf + req->line;
+        int len = lf - line;
+        if (len && line[len - 1] == '\r') { len--; }
+        req->scan = req->line = lf + 1 - buf;
+        if (req->state == PARSE_LINE) {
+            if (len == 0) {     // skip blank lines before request
+                req->start = req->line;
+            } else if (parse_request_line(req, line, len)) {
+                return HTTP_ERROR;
+            } else {
+                req->state = PARSE_HEADERS;
+            }
+        } else if (len == 0) {
+            req->state = PARSE_DONE;
+            req->method.ptr = buf + req->method_off;
+            req->method.len = req->method_len;
+            req->path.ptr = buf + req->path_off;
+            req->path.len = req->path_len;
+            req->query.ptr = buf + req->query_off;
+            req->query.len = req->query_len;
+            req->if_none_match.ptr = req->inm_len ? buf + req->inm_off : NULL;
+            req->if_none_match.len = req->inm_len;
+            return HTTP_DONE;
+        } else {
+            parse_header(req, line, len);
+        }
+    }
+    req->scan = req->cnt;
+    if (req->cnt == REQ_BUFSIZE && req->start == 0) {
+        return HTTP_TOO_LARGE;
+    }
+    return HTTP_AGAIN;
+}
+
+// value of name=value in query string, or def if absent
+int http_query_int(http_request *req, char *name, int def) {
+    int name_len = strlen(name);
+    char *p = req->query.ptr, *end = p + req->query.len;
+    while (p < end) {
+        char *amp = memchr(p, '&', end - p);
+        if (!amp) { amp = end; }
+        if (amp - p > name_len && p[name_len] == '=' &&
+            memcmp(p, name, name_len) == 0) {
+            return atoi(p + name_len + 1);
+        }
+        p = amp + 1;
+    }
+    return def;
+}
+
+// etag is in If-None-Match list, or it is *. W/ is ignored, the
+// weak comparison
+static int etag_listed(http_slice *inm, char *etag, int etag_len) {
+    char *p = inm->ptr, *end = p + inm->len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',')) { p++; }
+        char *t = p;
+        while (p < end && *p != ',' && *p != ' ') { p++; }
+        if (p - t == 1 && *t == '*') {
+            return 1;
+        }
+        if (p - t > 2 && t[0] == 'W' && t[1] == '/') {
+            t += 2;
+        }
+        if (p - t == etag_len && memcmp(t, etag, etag_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 304 or not for a GET. If-None-Match wins over If-Modified-Since.
+// etag is quoted, mtime 0 if unknown
+int http_not_modified(http_request *req, char *etag, int etag_len,
+                      time_t mtime) {
+    if (req->method.len != 3 || memcmp(req->method.ptr, "GET", 3)) {
+        return 0;
+    }
+    if (req->if_none_match.ptr) {
+        return etag_listed(&req->if_none_match, etag, etag_len);
+    }
+    return mtime && req->if_modified_since && mtime <= req->if_modified_since;
+}
+
+// current request is answered, pipelined bytes after it are kept
+void http_next(http_request *req) {
+    req->state = PARSE_LINE;
+    req->start = req->line;
+}
@@ -0,0 +1,71 @@
+#ifndef _HTTP_H_
+#define _HTTP_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REQ_BUFSIZE 2048        // whole request header, /b/ word list too
+
+// return value of http_parse
+#define HTTP_AGAIN 0            // need more bytes
+#define HTTP_DONE 1             // a whole request header is parsed
+#define HTTP_ERROR -1           // malformed request line
+#define HTTP_TOO_LARGE -2       // header can not fit in buffer
+
+// Accept-Encoding, bit 1 << ENC_* of search.h
+#define ACCEPT_IDENTITY 1       // always
+#define ACCEPT_GZIP 2
+#define ACCEPT_BR 4
+#define ACCEPT_ZSTD 8
+
+typedef struct {
+    char *ptr;                  // point into request buffer, \0 terminated
+    int len;
+} http_slice;
+
+// per connection parser, survive partial reads of edge triggered epoll
+typedef struct {
+    int state;                  // request line, headers, or done
+    int start;                  // offset of current request in buf
+    int line;                   // offset of the line being scanned
+    int scan;                   // offset next \n search start from
+    int cnt;                    // bytes in buf
+    int method_off, path_off;   // saved when request line is done
+    int method_len, path_len;
+    int query_off, query_len;
+    int inm_off, inm_len;       // If-None-Match value, 0 if none
+
+    // valid after HTTP_DONE, until http_next
+    http_slice method;
+    http_slice path;            // url decoded
+    http_slice query;           // after ?, url decoded
+    int http_minor;             // HTTP/1.x
+    int keep_alive;             // close or not after this response
+    int accept_enc;             // ACCEPT_* bits
+    http_slice if_none_match;   // ptr is NULL if absent
+    time_t if_modified_since;   // 0 if absent or malformed
+
+    char buf[REQ_BUFSIZE];
+} http_request;
+
+void http_init(http_request *req);
+
+int http_fill(http_request *req, int fd);
+
+int http_feed(http_request *req, char *data, int n);
+
+int http_parse(http_request *req);
+
+int http_query_int(http_request *req, char *name, int def);
+
+int http_not_modified(http_request *req, char *etag, int etag_len,
+                      time_t mtime);
+
+void http_next(http_request *req);
+
+#endif /* _HTTP_H_ */
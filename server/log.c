@@ -0,0 +1,229 @@
+#include "log.h"
+
+#define MAX_RINGS 256           // workers of a process
+#define LOG_LINE 512            // longest line formatted
+#define LOG_BUFSIZE 65536       // lines written at once
+
+static char *level_names[] = { "error", "warn", "info", "debug", "trace" };
+static int start_level = LOG_INFO;
+int *log_level = &start_level;  // log_init share it
+
+// of one worker, it push, the writer thread pop. head and tail on
+// their own cache lines
+typedef struct {
+    unsigned long tail;         // written by the worker
+    char pad1[56];
+    unsigned long head;         // written by the writer
+    char pad2[56];
+    int worker;
+    long *dropped;              // ring was full, in its worker_stats
+    long dropped_seen;          // by the writer
+    log_record records[LOG_RING];
+} log_ring;
+
+static log_ring *rings[MAX_RINGS]; // of this process
+static int ring_count;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static cpu_set_t allowed;       // the writer may run on any of them
+static __thread log_ring *own;
+
+int log_level_of(char *name) {
+    for (int i = LOG_ERROR; i <= LOG_TRACE; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// SIGUSR1 one more level, SIGUSR2 one less
+static void change_level(int sig) {
+    int level = __atomic_load_n(log_level, __ATOMIC_RELAXED) +
+        (sig == SIGUSR1 ? 1 : -1);
+    if (level >= LOG_ERROR && level <= LOG_TRACE) {
+        __atomic_store_n(log_level, level, __ATOMIC_RELAXED);
+    }
+}
+
+// before workers start: the level is in a shared page, a signal to
+// any process or thread change it for all
+void log_init(int level) {
+    struct sigaction sa;
+    int *shared = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap log level");
+        exit(EXIT_FAILURE);
+    }
+    *shared = level;
+    log_level = shared;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = change_level;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+// a line, \n ended, at most LOG_LINE bytes. The date is made once a second
+static int format_record(log_record *rec, int worker, char *buf) {
+    static __thread time_t last_sec = -1;
+    static __thread char date[32];
+    time_t sec = rec->time_us / 1000000;
+    if (sec != last_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        last_sec = sec;
+    }
+    int n = snprintf(buf, LOG_LINE, "%s.%06ld %s worker %d: ", date,
+                     (long)(rec->time_us % 1000000), level_names[rec->level],
+                     worker);
+    long *a = rec->args;
+    if (rec->has_text) {
+        n += snprintf(buf + n, LOG_LINE - n, rec->fmt, rec->text,
+                      a[0], a[1], a[2], a[3]);
+    } else {
+        n += snprintf(buf + n, LOG_LINE - n, rec->fmt, a[0], a[1], a[2], a[3]);
+    }
+    if (n > LOG_LINE - 1) {     // cut
+        n = LOG_LINE - 1;
+    }
+    buf[n++] = '\n';
+    return n;
+}
+
+static void write_all(int fd, char *buf, int length) {
+    while (length > 0) {
+        ssize_t n = write(fd, buf, length);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            return;             // nowhere to log it
+        }
+        buf += n;
+        length -= n;
+    }
+}
+
+static void fill_record(log_record *rec, int level, const char *text,
+                        const char *fmt, long a, long b, long c, long d) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->time_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    rec->fmt = fmt;
+    rec->args[0] = a;
+    rec->args[1] = b;
+    rec->args[2] = c;
+    rec->args[3] = d;
+    rec->level = level;
+    rec->has_text = text != NULL;
+    if (text) {
+        size_t n = strnlen(text, LOG_TEXT_LEN - 1);
+        memcpy(rec->text, text, n);
+        rec->text[n] = '\0';
+    }
+}
+
+// drain all rings, write in batches. Sleep LOG_FLUSH_MS after a round,
+// unless a ring was half full
+static void* log_writer(void *arg) {
+    char *buf = malloc(LOG_BUFSIZE);
+    struct timespec nap = { 0, LOG_FLUSH_MS * 1000000L };
+    while (1) {
+        int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE), busy = 0;
+        int length = 0;
+        for (int i = 0; i < count; i++) {
+            log_ring *r = rings[i];
+            unsigned long h = r->head;
+            unsigned long t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+            if (t - h >= LOG_RING / 2) {
+                busy = 1;
+            }
+            for (; h != t; h++) {
+                if (length > LOG_BUFSIZE - LOG_LINE) {
+                    write_all(STDOUT_FILENO, buf, length);
+                    length = 0;
+                }
+                length += format_record(r->records + (h & (LOG_RING - 1)),
+                                        r->worker, buf + length);
+            }
+            __atomic_store_n(&r->head, h, __ATOMIC_RELEASE);
+            long dropped = __atomic_load_n(r->dropped, __ATOMIC_RELAXED);
+            if (dropped != r->dropped_seen) {
+                log_record rec;
+                fill_record(&rec, LOG_WARN, NULL, "%ld log records dropped",
+                            dropped - r->dropped_seen, 0, 0, 0);
+                r->dropped_seen = dropped;
+                if (length > LOG_BUFSIZE - LOG_LINE) {
+                    write_all(STDOUT_FILENO, buf, length);
+                    length = 0;
+                }
+                length += format_record(&rec, r->worker, buf + length);
+            }
+        }
+        write_all(STDOUT_FILENO, buf, length);
+        if (!busy) {
+            nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+// one writer a process, started by its first worker
+static void start_writer() {
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(allowed), &allowed);
+    if (pthread_create(&tid, &attr, log_writer, NULL)) {
+        perror("pthread_create log writer");
+        exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// calling thread get a ring. Full rings count into dropped, which only
+// this thread write
+void log_attach(int worker, long *dropped) {
+    log_ring *r;
+    if (posix_memalign((void**)&r, 64, sizeof(log_ring))) {
+        return;                 // log the slow way
+    }
+    memset(r, 0, sizeof(log_ring));
+    r->worker = worker;
+    r->dropped = dropped;
+    pthread_mutex_lock(&rings_lock);
+    if (ring_count < MAX_RINGS) {
+        rings[ring_count] = r;
+        __atomic_store_n(&ring_count, ring_count + 1, __ATOMIC_RELEASE);
+        own = r;
+    }
+    pthread_mutex_unlock(&rings_lock);
+    if (!own) {
+        free(r);
+        return;
+    }
+    pthread_once(&writer_once, start_writer);
+}
+
+// a record into the ring of the thread, dropped if it is full. Threads
+// without one, as before workers start, write to stderr now
+void log_push(int level, const char *text, const char *fmt,
+              long a, long b, long c, long d) {
+    log_ring *r = own;
+    if (!r) {
+        log_record rec;
+        char line[LOG_LINE];
+        fill_record(&rec, level, text, fmt, a, b, c, d);
+        write_all(STDERR_FILENO, line, format_record(&rec, 0, line));
+        return;
+    }
+    unsigned long t = r->tail;
+    if (t - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == LOG_RING) {
+        (*r->dropped)++;
+        return;
+    }
+    fill_record(r->records + (t & (LOG_RING - 1)), level, text, fmt, a, b, c, d);
+    __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+}
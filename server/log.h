@@ -0,0 +1,65 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+#define LOG_TRACE 4             // every write and wake up
+
+#define LOG_RING 4096           // records a worker can have waiting, power of 2
+#define LOG_TEXT_LEN 76         // a record is 128 bytes
+#define LOG_FLUSH_MS 10         // writer sleep when all rings are empty
+
+// fixed size, formatted later by the writer thread
+typedef struct {
+    uint64_t time_us;           // wall clock
+    const char *fmt;            // a literal, it live as long as the program
+    long args[4];
+    short level, has_text;
+    char text[LOG_TEXT_LEN];    // copy of the string argument, if any
+} log_record;
+
+extern int *log_level;          // shared by all workers
+
+// at most 4 numbers, printed with %ld. 0 pad the missing ones
+#define LOG_ARGS(fmt, a, b, c, d, ...) \
+    fmt, (long)(a), (long)(b), (long)(c), (long)(d)
+
+// LOG(LOG_DEBUG, "close sock_fd %ld", fd). Arguments are not evaluated
+// if the level is off
+#define LOG(level, ...) do {                                        \
+        if ((level) <= *log_level) {                                \
+            log_push(level, NULL, LOG_ARGS(__VA_ARGS__, 0, 0, 0, 0, 0)); \
+        }                                                           \
+    } while (0)
+
+// with a string, it is copied, and is the first %s of the format
+#define LOGS(level, text, ...) do {                                 \
+        if ((level) <= *log_level) {                                \
+            log_push(level, text, LOG_ARGS(__VA_ARGS__, 0, 0, 0, 0, 0)); \
+        }                                                           \
+    } while (0)
+
+int log_level_of(char *name);
+
+void log_init(int level);
+
+void log_attach(int worker, long *dropped);
+
+void log_push(int level, const char *text, const char *fmt,
+              long a, long b, long c, long d);
+
+#endif /* _LOG_H_ */
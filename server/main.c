@@ -3,41 +3,83 @@
 #include "search.h"
 #include "network.h"
 #include "static.h"
+#include "response.h"
+#include "slab.h"
+#include "complete.h"
+#include "suggest.h"
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 
-#define GZIP_MAGIC 0x8b1f
-static char gzip_header[] = {
-    (char) GZIP_MAGIC,          // Magic number (short)
-    (char) (GZIP_MAGIC >> 8),   // Magic number (short)
-    8,                    // Compression method (CM) Deflater.DEFLATED
-    0,                    // Flags (FLG)
-    0,                    // Modification time MTIME (int)
-    0,                    // Modification time MTIME (int)
-    0,                    // Modification time MTIME (int)
-    0,                    // Modification time MTIME (int)
-    0,                    // Extra flags (XFLG)
-    0                     // Operating system (OS)
-};
-
-static char *json_headers = "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\nCache-Control: max-age=86400, public\r\nContent-Type: application/json\r\n\r\n";
-static char *gziped_json_headers = "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\nCache-Control: max-age=86400, public\r\nContent-Encoding: gzip\r\nContent-Type: application/json\r\n\r\n";
-
-int nonb_write_headers(int fd, char* bufp, int nleft, dict_epoll_data *ptr) {
-    int nwritten;
-    while(nleft > 0) {
-        if((nwritten = write(fd, bufp, nleft)) <= 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                ptr->headers_cnt = nleft;
-                ptr->headers_bufptr = bufp;
+// set by options, then read only
+static int sendfile_min = SENDFILE_MIN;
+static int timeouts[4] = { 0, 10, 60, 30 }; // seconds by TIMER_*, 0 never
+static int port = 9090, reuseport, shared_listen = -1;
+static int max_conns = 10240, max_active;
+static int want_uring;          // -e uring
+static char *access_prefix;     // -A, access log files, NULL is off
+static int access_sample = 1;
+static worker_stats *all_stats; // shared, by worker id - 1
+static int worker_total;
+
+// of a worker: a process, or with -T a thread
+static __thread int worker_id;
+static __thread worker_stats *stats; // its slot in all_stats
+static __thread slab conn_slab; // dict_conn of this worker, one a socket
+static __thread slab state_slab; // dict_epoll_data, only connections busy
+static __thread slab body_slab; // DYN_BUFSIZE buffers, far less than conns
+static __thread slab batch_slab; // BATCH_BUFSIZE buffers, fewer still
+static __thread int reserve_fd; // spare fd for EMFILE
+static __thread timer_wheel wheel; // deadlines of all connections
+static __thread int use_uring;  // io_uring backend, else epoll
+static __thread uring ring;
+static __thread int pipes[URING_PIPES][2]; // made when needed, then reused
+static __thread int pipe_free[URING_PIPES], pipe_free_cnt, pipe_made;
+static __thread access_log alog; // prefix.worker_id
+static __thread dict_conn **parked; // io_uring: recv waiting for a buffer
+static __thread int parked_cnt;
+static __thread unsigned short buf_seen; // ring.buf_tail, last unpark
+
+// n bytes of the iovecs are written
+static void iov_advance(dict_epoll_data *ptr, size_t n) {
+    struct iovec *iov = (ptr->iov_ext ? ptr->iov_ext : ptr->iov) + ptr->iov_idx;
+    while (ptr->iov_cnt && n >= iov->iov_len) {
+        n -= iov->iov_len;
+        iov++;
+        ptr->iov_idx++;
+        ptr->iov_cnt--;
+    }
+    if (n) {                    // partial iovec
+        iov->iov_base = (char*)iov->iov_base + n;
+        iov->iov_len -= n;
+    }
+}
+
+// write iovecs from iov_idx, save where it is blocked. If a file
+// follows, MSG_MORE keep headers and file in the same segments
+int nonb_writev(dict_epoll_data *ptr) {
+    while (ptr->iov_cnt) {
+        struct iovec *iov = (ptr->iov_ext ? ptr->iov_ext : ptr->iov) + ptr->iov_idx;
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = ptr->iov_cnt };
+        ssize_t nwritten = sendmsg(ptr->sock_fd, &msg,
+                                   MSG_NOSIGNAL | (ptr->file_cnt ? MSG_MORE : 0));
+        if (nwritten <= 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ptr->iov_cnt = 0; // peer is gone, EPOLLERR will clean
+            } else {
+                stats->write_eagain++;
             }
             return 0;           // blocked, do not continue
         }
-#ifdef VERBOSE
-        printf("write headers count %d, sock_fd %d\n", nwritten, fd);
-#endif
-        nleft -= nwritten;
-        bufp += nwritten;
+        stats->bytes_out += nwritten;
+        ptr->sent += nwritten;
+        LOG(LOG_TRACE, "writev count %ld, sock_fd %ld", nwritten, ptr->sock_fd);
+        iov_advance(ptr, nwritten);
+        if (ptr->iov_cnt) {
+            stats->partial_writes++;
+        }
     }
-    ptr->headers_cnt = 0;       // done all
     return 1;
 }
 
@@ -45,75 +87,209 @@ int nonb_sendfile(dict_epoll_data *ptr) {
     int nsent;
     off_t offset = ptr->file_offset;
     while (ptr->file_cnt) {
-        nsent = sendfile(ptr->sock_fd, ptr->static_fd, &offset, ptr->file_cnt);
+        nsent = sendfile(ptr->sock_fd, ptr->file_fd, &offset, ptr->file_cnt);
         if(nsent > 0) {
             ptr->file_cnt -= nsent;
             ptr->file_offset = offset; //  save for next call
+            stats->bytes_out += nsent;
+            ptr->sent += nsent;
+            if (ptr->file_cnt) {
+                stats->partial_writes++;
+            }
         } else {
-#ifdef DEBUG
-            printf("sendfile return early: %d\n", nsent);
-#endif
+            if (nsent < 0 && errno == EAGAIN) {
+                stats->write_eagain++;
+            }
+            LOG(LOG_TRACE, "sendfile return early: %ld", nsent);
             return 0;
         }
-#ifdef DEBUG
-        printf("sendfile sock_fd: %d, file_fd: %d, bytes: %d\n",
-               ptr->sock_fd, ptr->static_fd, nsent);
-#endif
-    }
-    if (ptr->static_fd) {       // finish send file
-        close(ptr->static_fd);
-        close(ptr->sock_fd);              //  do not keep-alive
-        ptr->static_fd = 0;
+        LOG(LOG_TRACE, "sendfile sock_fd: %ld, file_fd: %ld, bytes: %ld",
+            ptr->sock_fd, ptr->file_fd, nsent);
     }
     return 1;
 }
 
-int nonb_write_body(int fd, char* bufp, int nleft, dict_epoll_data *ptr) {
-    int nwritten;
-    while(nleft > 0) {
-        if((nwritten = write(fd, bufp, nleft)) <= 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                ptr->body_bufptr = bufp;
-                ptr->body_cnt = nleft;
-            }
-            return 0;           // blocked, do not continue
+static int response_pending(dict_epoll_data *ptr) {
+    return ptr->iov_cnt || ptr->file_cnt || ptr->pipe_cnt;
+}
+
+static void set_timer(dict_conn *conn, int kind) {
+    conn->timer_kind = kind;
+    if (timeouts[kind] > 0) {
+        timer_add(&wheel, &conn->timer,
+                  timer_now() + timeouts[kind] * 1000 / TIMER_TICK_MS);
+    } else {
+        timer_del(&wheel, &conn->timer);
+    }
+}
+
+// state for a connection that has something to do. NULL if the pool
+// is empty
+static dict_epoll_data* acquire_state(dict_conn *conn) {
+    dict_epoll_data *ptr = slab_alloc(&state_slab);
+    if (ptr) {
+        ptr->conn = conn;
+        ptr->sock_fd = conn->sock_fd;
+        ptr->iov_cnt = 0;       // init, default value
+        ptr->file_cnt = 0;
+        ptr->asset = NULL;
+        ptr->body_buf = NULL;
+        ptr->iov_ext = NULL;
+        ptr->pipe_idx = -1;
+        ptr->pipe_cnt = 0;
+        ptr->held_len = 0;
+        ptr->uring_wait = 0;
+        ptr->db = NULL;
+        http_init(&ptr->req);
+        conn->state = ptr;
+    }
+    return ptr;
+}
+
+static void release_body(dict_epoll_data *ptr) {
+    if (ptr->body_buf) {
+        slab_free(ptr->body_pool, ptr->body_buf);
+        ptr->body_buf = NULL;
+        ptr->iov_ext = NULL;
+    }
+}
+
+// back to the pool. Bytes left in it, closed in the middle of a
+// response: a new one, a pipe can not be emptied cheaply
+static void release_pipe(dict_epoll_data *ptr) {
+    int *p;
+    if (ptr->pipe_idx < 0) {
+        return;
+    }
+    p = pipes[ptr->pipe_idx];
+    if (ptr->pipe_cnt) {
+        close(p[0]);
+        close(p[1]);
+        ptr->pipe_cnt = 0;
+        if (pipe2(p, O_NONBLOCK | O_CLOEXEC)) {
+            perror("pipe2");
+            exit(EXIT_FAILURE);
         }
-#ifdef VERBOSE
-        printf("write body count %d, fd %d\n", nwritten, fd);
-#endif
-        nleft -= nwritten;
-        bufp += nwritten;
     }
-    close(fd);                  // do not keep-alive
-    ptr->body_cnt = 0;          // done all
-    return 1;
+    pipe_free[pipe_free_cnt++] = ptr->pipe_idx;
+    ptr->pipe_idx = -1;
 }
 
-void accept_incoming(int listen_sock, int epollfd) {
-    struct sockaddr_in clientaddr;
-    socklen_t clientlen = sizeof clientaddr;
-    int conn_sock = accept(listen_sock, (SA *)&clientaddr, &clientlen);
-    if (conn_sock <= 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // printf("all connection\n"); //  we have done all
-        } else {
-            perror("accept");
+static void release_state(dict_conn *conn) {
+    dict_epoll_data *ptr = conn->state;
+    if (ptr) {
+        static_release(ptr);
+        release_body(ptr);
+        release_pipe(ptr);
+        if (ptr->held_len) {
+            uring_recycle(&ring, ptr->held_bid);
+        }
+        if (ptr->db) {          // closed before it was all written
+            db_drop(ptr->db);
+        }
+        slab_free(&state_slab, ptr);
+        conn->state = NULL;
+    }
+}
+
+// after every event of a connection. Header deadline is from the first
+// byte of a request, more bytes do not extend it: slowloris. Write
+// deadline is extended only when bytes of the response went out, not
+// by bytes coming in. Nothing buffered, nothing to write: the state
+// goes back to the pool, only conn is kept
+static void update_timer(dict_conn *conn) {
+    dict_epoll_data *ptr = conn->state;
+    if (ptr && response_pending(ptr)) {
+        if (conn->timer_kind != TIMER_WRITE || ptr->sent != ptr->timer_sent) {
+            ptr->timer_sent = ptr->sent;
+            set_timer(conn, TIMER_WRITE);
+        }
+    } else if (ptr && ptr->req.cnt > ptr->req.start) {
+        if (conn->timer_kind != TIMER_HEADER) {
+            set_timer(conn, TIMER_HEADER);
         }
     } else {
-#ifdef DEBUG
-        printf("accept %s:%d, sock_fd is %d\n", inet_ntoa(clientaddr.sin_addr),
-               ntohs(clientaddr.sin_port), conn_sock);
-#endif
-        // make_socket_non_blokcing(conn_sock);
+        release_state(conn);
+        if (conn->timer_kind != TIMER_IDLE) {
+            set_timer(conn, TIMER_IDLE);
+        }
+    }
+}
+
+// out of fd, give up the reserved one to accept and close a connection,
+// or the level triggered listen socket keep waking us
+static void shed_connection(int listen_sock) {
+    close(reserve_fd);
+    int conn_sock = accept(listen_sock, NULL, NULL);
+    if (conn_sock >= 0) {
+        close(conn_sock);
+        stats->accept_shed++;
+    }
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+// IPv4 of the peer of fd, a syscall: only if the access log is on
+static uint32_t peer_addr(int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (!alog.map || getpeername(fd, (SA *)&addr, &len) ||
+        addr.sin_family != AF_INET) {
+        return 0;
+    }
+    return addr.sin_addr.s_addr;
+}
+
+// record of an accepted socket, NULL and closed if too many. client
+// is the IPv4 of the peer, 0 if unknown
+static dict_conn* new_conn(int conn_sock, uint32_t client) {
+    dict_conn *conn = slab_alloc(&conn_slab);
+    if (!conn) {                // too many, -c to raise
+        LOG(LOG_WARN, "connection slab is full, close sock_fd %ld", conn_sock);
+        close(conn_sock);
+        return NULL;
+    }
+    stats->accept_total++;
+    conn->sock_fd = conn_sock;
+    conn->timer.next = NULL;
+    conn->timer_kind = 0;
+    conn->uring_ops = conn->uring_recv = 0;
+    conn->client = client;
+    conn->state = NULL;         // until it has bytes to read
+    update_timer(conn);
+    return conn;
+}
+
+// drain the backlog, at most ACCEPT_BUDGET a round, the rest wait for
+// next epoll_wait, connections already accepted get served first
+void accept_incoming(int listen_sock, int epollfd) {
+    for (int i = 0; i < ACCEPT_BUDGET; i++) {
+        struct sockaddr_in clientaddr;
+        socklen_t clientlen = sizeof clientaddr;
+        int conn_sock = accept4(listen_sock, (SA *)&clientaddr, &clientlen,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn_sock < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;         // we have done all
+            } else if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if (errno == EMFILE || errno == ENFILE) {
+                shed_connection(listen_sock);
+                continue;
+            }
+            LOGS(LOG_ERROR, strerror(errno), "accept: %s");
+            return;
+        }
+        LOGS(LOG_DEBUG, inet_ntoa(clientaddr.sin_addr),
+             "accept %s:%ld, sock_fd is %ld", ntohs(clientaddr.sin_port),
+             conn_sock);
         struct epoll_event ev;
-        dict_epoll_data *data = malloc(sizeof(dict_epoll_data));
-        data->sock_fd = conn_sock;
-        data->body_cnt = 0;     // init, default value
-        data->headers_cnt = 0;
-        data->file_cnt = 0;
-        data->static_fd = 0;
-        ev.data.ptr = data;
-        ev.events = EPOLLIN | EPOLLOUT | EPOLLET; //  read, edge triggered
+        dict_conn *conn = new_conn(conn_sock, clientaddr.sin_addr.s_addr);
+        if (!conn) {
+            continue;
+        }
+        ev.data.ptr = conn;
+        // edge triggered, bytes already here are reported at once
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
         if (epoll_ctl(epollfd, EPOLL_CTL_ADD, conn_sock, &ev) == -1) {
             perror("epoll_ctl: for read");
             exit(EXIT_FAILURE);
@@ -121,127 +297,670 @@ void accept_incoming(int listen_sock, int epollfd) {
     }
 }
 
-void close_and_clean(dict_epoll_data *ptr, int epollfd) {
+static void free_conn(dict_conn *conn) {
+    release_state(conn);
+    slab_free(&conn_slab, conn);
+}
+
+static void unpark(dict_conn *conn);
+
+void close_and_clean(dict_conn *conn, int epollfd) {
+    if (conn->uring_recv == URING_PARKED) {
+        unpark(conn);
+    }
     // closing a file descriptor cause it to be removed from all epoll sets automatically
-    // epoll_ctl(epollfd, EPOLL_CTL_DEL, ptr->sock_fd, NULL);
-    close(ptr->sock_fd);
-    if (ptr->static_fd) {
-        close(ptr->static_fd);
+    // epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->sock_fd, NULL);
+    if (conn->uring_ops) {
+        // io_uring requests hold the socket, end them now. Buffers
+        // they use are freed when the last one is done
+        shutdown(conn->sock_fd, SHUT_RDWR);
+        close(conn->sock_fd);
+        conn->sock_fd = -1;
+        timer_del(&wheel, &conn->timer);
+        return;
     }
-    free(ptr);
+    close(conn->sock_fd);
+    timer_del(&wheel, &conn->timer);
+    free_conn(conn);
 }
 
-void handle_request(dict_epoll_data *ptr, char uri[]) {
-    int uri_length = strlen(uri);
-    if (uri_length > 3 && uri[0] == '/' && uri[1] == 'd' && uri[2] == '/') {
-        char *loc = search_word(uri + 3); // 3 is /d/:word
-        if (loc) {
-            int data_size = read_short(loc, 0);
-            int header_length = 0;
-            char *headers = ptr->headers;
-            if (data_size > 0xe000) { // first bit: is not gzipped
-                data_size -= 0xe000;
-                sprintf(headers, json_headers, data_size);
-                header_length = strlen(headers);
-            } else {
+// HTTP/1.1 is persistent by default, 1.0 only if asked
+char* conn_header(dict_epoll_data *ptr) {
+    if (!ptr->req.keep_alive) {
+        return "Connection: close\r\n";
+    } else if (ptr->req.http_minor == 0) {
+        return "Connection: keep-alive\r\n";
+    }
+    return "";
+}
 
-                #ifdef DEBUG
-                    printf("gzipd %d\n", ptr->sock_fd);
-                #endif
-                sprintf(headers, gziped_json_headers, data_size + 10);
-                header_length = strlen(headers);
-                // copy gzip_header with http headers
-                memcpy(headers + header_length, gzip_header, 10);
-                header_length += 10;
-            }
-            int cont = nonb_write_headers(ptr->sock_fd, headers,
-                                          header_length, ptr);
-            if (cont) {
-                // 2 byte for size, 1 byte for zipped or not
-                #ifdef DEBUG
-                    printf("write by handle_request sock_fd %d %d\n", ptr->sock_fd,cont);
-                #endif
-                nonb_write_body(ptr->sock_fd, loc + 2, data_size, ptr);
-            } else {
-                ptr->body_bufptr = loc;
-                ptr->body_cnt = data_size;
+// close connections whose deadline passed, all at once
+static void expire_timers(int epollfd) {
+    timer_node expired, *n;
+    timer_advance(&wheel, timer_now(), &expired);
+    while ((n = timer_pop(&expired))) {
+        dict_conn *conn = (dict_conn*)n;
+        stats->timeout_count[conn->timer_kind]++;
+        LOG(LOG_DEBUG, "timeout %ld, close sock_fd %ld", conn->timer_kind,
+            conn->sock_fd);
+        close_and_clean(conn, epollfd);
+    }
+}
+
+// response is all written, close or wait for next request
+static int finish_response(dict_epoll_data *ptr, int epollfd) {
+    uint64_t latency = now_us() - ptr->req_start;
+    hist_record(stats->latency + ptr->route, latency);
+    stats->access_records += access_end(&alog, &ptr->access, ptr->route,
+                                        ptr->status, ptr->sent, latency);
+    ptr->conn->timer_kind = 0;  // next request has its own deadline
+    static_release(ptr);
+    release_body(ptr);
+    release_pipe(ptr);
+    db_drop(ptr->db);
+    ptr->db = NULL;
+    if (!ptr->req.keep_alive) {
+        LOG(LOG_DEBUG, "response done, close sock_fd %ld", ptr->sock_fd);
+        close_and_clean(ptr->conn, epollfd);
+        return 0;
+    }
+    http_next(&ptr->req);
+    return 1;
+}
+
+// io_uring: the request buffer is filled from the provided buffer
+// the last recv took, what does not fit waits there
+static int uring_fill(dict_epoll_data *ptr) {
+    if (ptr->held_len) {
+        char *data = uring_buffer(&ring, ptr->held_bid) + ptr->held_off;
+        int n = http_feed(&ptr->req, data, ptr->held_len);
+        ptr->held_off += n;
+        if (!(ptr->held_len -= n)) {
+            uring_recycle(&ring, ptr->held_bid);
+        }
+    }
+    return 1;
+}
+
+// sqe of conn, counted in flight until its completion
+static struct io_uring_sqe* conn_sqe(dict_conn *conn, int op, int tag) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+    if (!sqe) {
+        fprintf(stderr, "io_uring submission queue full\n");
+        exit(EXIT_FAILURE);
+    }
+    sqe->opcode = op;
+    sqe->fd = conn->sock_fd;
+    sqe->user_data = (unsigned long)conn | tag;
+    conn->uring_ops++;
+    return sqe;
+}
+
+static void uring_recv(dict_conn *conn) {
+    struct io_uring_sqe *sqe = conn_sqe(conn, IORING_OP_RECV, UR_RECV);
+    sqe->flags = IOSQE_BUFFER_SELECT; // len 0: the whole buffer
+    sqe->buf_group = 0;
+    conn->uring_recv = 1;
+}
+
+static int get_pipe() {
+    if (pipe_free_cnt) {
+        return pipe_free[--pipe_free_cnt];
+    }
+    // non-blocking, or a splice out of an empty one hang forever
+    if (pipe_made < URING_PIPES &&
+        pipe2(pipes[pipe_made], O_NONBLOCK | O_CLOEXEC) == 0) {
+        return pipe_made++;
+    }
+    return -1;
+}
+
+// queue the rest of the response as one linked chain: sendmsg of the
+// iovecs, file to pipe, pipe to socket. The next chain, if any, is
+// queued when all of this one is done. No pipe free: poll, then
+// sendfile as epoll does
+static void uring_send(dict_epoll_data *ptr) {
+    dict_conn *conn = ptr->conn;
+    struct io_uring_sqe *sqe = NULL;
+    int out = ptr->pipe_cnt;
+    if (ptr->iov_cnt) {
+        memset(&ptr->msg, 0, sizeof(ptr->msg));
+        ptr->msg.msg_iov = (ptr->iov_ext ? ptr->iov_ext : ptr->iov) + ptr->iov_idx;
+        ptr->msg.msg_iovlen = ptr->iov_cnt;
+        sqe = conn_sqe(conn, IORING_OP_SENDMSG, UR_SEND);
+        sqe->addr = (unsigned long)&ptr->msg;
+        // all or error, a short one must not let the file go after it
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL |
+            (ptr->file_cnt ? MSG_MORE : 0);
+    }
+    if (!out && ptr->file_cnt && ptr->pipe_idx < 0 &&
+        (ptr->pipe_idx = get_pipe()) < 0) {
+        ptr->uring_wait = 1;
+    }
+    if (ptr->uring_wait && (out || ptr->file_cnt)) { // wait for room
+        if (sqe) { sqe->flags |= IOSQE_IO_LINK; }
+        sqe = conn_sqe(conn, IORING_OP_POLL_ADD, UR_POLL);
+        sqe->poll32_events = POLLOUT;
+        ptr->uring_wait = 0;
+        if (ptr->pipe_idx < 0) {
+            return;             // sendfile when it is done
+        }
+    }
+    if (!out && ptr->file_cnt) {
+        if (sqe) { sqe->flags |= IOSQE_IO_LINK; }
+        out = ptr->file_cnt < PIPE_CHUNK ? ptr->file_cnt : PIPE_CHUNK;
+        sqe = conn_sqe(conn, IORING_OP_SPLICE, UR_SPLICE_IN);
+        sqe->splice_fd_in = ptr->file_fd;
+        sqe->splice_off_in = ptr->file_offset;
+        sqe->fd = pipes[ptr->pipe_idx][1];
+        sqe->off = -1;
+        sqe->len = out;
+    }
+    if (out) {
+        if (sqe) { sqe->flags |= IOSQE_IO_LINK; }
+        sqe = conn_sqe(conn, IORING_OP_SPLICE, UR_SPLICE_OUT);
+        sqe->splice_fd_in = pipes[ptr->pipe_idx][0];
+        sqe->splice_off_in = -1;
+        sqe->off = -1;
+        sqe->len = out;
+    }
+}
+
+// start writing what iov and file describe. epoll: now, as much as the
+// socket take. io_uring: queued, submitted with the next wait
+void send_response(dict_epoll_data *ptr) {
+    if (use_uring) {
+        uring_send(ptr);
+    } else if (nonb_writev(ptr) && ptr->file_cnt) {
+        nonb_sendfile(ptr);
+    }
+}
+
+static char *dynamic_headers = "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nCache-Control: %s\r\nContent-Type: %s\r\n%s\r\n";
+
+static void count_error(int status) {
+    if (status >= 500) {
+        stats->error_5xx++;
+    } else {
+        stats->error_4xx++;
+    }
+}
+
+// refuse a connection that has no state, it is closed after. The only
+// write not through send_response: nothing else is queued on it
+static void send_error(int fd, int status, char *msg) {
+    count_error(status);
+    client_error(fd, status, msg, "");
+}
+
+static char *error_headers = "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n%s\r\n";
+
+// error page to the request of ptr, written as any response, in order
+// with the pipelined ones. Its status is logged
+void reply_error(dict_epoll_data *ptr, int status, char *msg) {
+    count_error(status);
+    ptr->status = status;
+    ptr->file_cnt = 0;
+    ptr->iov_ext = NULL;
+    ptr->iov[0].iov_base = ptr->headers;
+    ptr->iov[0].iov_len = snprintf(ptr->headers, RESP_HEADER_LENTH,
+                                   error_headers, status, msg,
+                                   conn_header(ptr));
+    ptr->iov_idx = 0;
+    ptr->iov_cnt = 1;
+    send_response(ptr);
+}
+
+// buffer for a generated body, kept until the response is written
+static char* pool_buffer(dict_epoll_data *ptr, slab *pool) {
+    if (!ptr->body_buf && !(ptr->body_buf = slab_alloc(pool))) {
+        reply_error(ptr, 503, "Service Unavailable");
+    }
+    ptr->body_pool = pool;
+    return ptr->body_buf;
+}
+
+static char* body_buffer(dict_epoll_data *ptr) {
+    return pool_buffer(ptr, &body_slab);
+}
+
+// length bytes of body are in ptr->body_buf
+static void send_dynamic(dict_epoll_data *ptr, char *content_type,
+                         char *cache_control, int length) {
+    int n = sprintf(ptr->headers, dynamic_headers, length, cache_control,
+                    content_type, conn_header(ptr));
+    ptr->iov[0].iov_base = ptr->headers;
+    ptr->iov[0].iov_len = n;
+    ptr->iov[1].iov_base = ptr->body_buf;
+    ptr->iov[1].iov_len = length;
+    ptr->iov_idx = 0;
+    ptr->iov_cnt = 2;
+    send_response(ptr);
+}
+
+// one per line: pools and static files of the worker answering, then
+// counters of all workers, or of one with ?worker=N. Latency
+// percentiles by route come from their histograms added up, ?hist=1
+// list the buckets too
+static void serve_stats(dict_epoll_data *ptr) {
+    worker_stats total;
+    uint64_t generation;
+    long reload_failed;
+    int retiring;
+    int w = http_query_int(&ptr->req, "worker", 0);
+    char *body = pool_buffer(ptr, &batch_slab);
+    if (!body) { return; }
+    if (w >= 1 && w <= worker_total) {
+        stats_sum(&total, all_stats + w - 1, 1);
+    } else {
+        stats_sum(&total, all_stats, worker_total);
+    }
+    db_status(&generation, &reload_failed, &retiring); // of this process
+    int length = snprintf(body, BATCH_BUFSIZE,
+                          "pid %d\n"
+                          "worker %d\n"
+                          "workers %d\n"
+                          "backend %s\n"
+                          "conn_in_use %d\n"
+                          "conn_capacity %d\n"
+                          "conn_peak %d\n"
+                          "conn_rejected %ld\n"
+                          "conn_slab_bytes %lu\n"
+                          "conn_bytes %lu\n"
+                          "state_in_use %d\n"
+                          "state_capacity %d\n"
+                          "state_peak %d\n"
+                          "state_rejected %ld\n"
+                          "state_slab_bytes %lu\n"
+                          "state_bytes %lu\n"
+                          "body_in_use %d\n"
+                          "body_capacity %d\n"
+                          "body_rejected %ld\n"
+                          "batch_in_use %d\n"
+                          "batch_capacity %d\n"
+                          "batch_rejected %ld\n"
+                          "static_files %d\n"
+                          "static_reloads %ld\n"
+                          "requests %ld\n"
+                          "loop_waits %ld\n"
+                          "accept_total %ld\n"
+                          "accept_shed %ld\n"
+                          "entry_hit %ld\n"
+                          "entry_miss %ld\n"
+                          "batch_hit %ld\n"
+                          "batch_miss %ld\n"
+                          "static_hit %ld\n"
+                          "static_miss %ld\n"
+                          "error_4xx %ld\n"
+                          "error_5xx %ld\n"
+                          "bytes_in %ld\n"
+                          "bytes_out %ld\n"
+                          "partial_writes %ld\n"
+                          "write_eagain %ld\n"
+                          "entry_copy %ld\n"
+                          "entry_copy_bytes %ld\n"
+                          "entry_sendfile %ld\n"
+                          "entry_sendfile_bytes %ld\n"
+                          "entry_identity %ld\n"
+                          "entry_gzip %ld\n"
+                          "entry_br %ld\n"
+                          "entry_zstd %ld\n"
+                          "entry_inflated %ld\n"
+                          "not_modified %ld\n"
+                          "timeout_header %ld\n"
+                          "timeout_idle %ld\n"
+                          "timeout_write %ld\n"
+                          "log_level %d\n"
+                          "log_dropped %ld\n"
+                          "access_records %ld\n"
+                          "dict_generation %lu\n"
+                          "dict_words %d\n"
+                          "dict_reload_failed %ld\n"
+                          "dict_retiring %d\n"
+                          "dict_residency %s\n"
+                          "dict_mapped_bytes %ld\n"
+                          "dict_resident_bytes %lu\n"
+                          "dict_locked %d\n"
+                          "anon_huge_bytes %ld\n",
+                          getpid(), worker_id, worker_total,
+                          use_uring ? "io_uring" : "epoll",
+                          conn_slab.in_use, conn_slab.capacity,
+                          conn_slab.peak, conn_slab.full,
+                          conn_slab.obj_size * conn_slab.capacity,
+                          conn_slab.obj_size,
+                          state_slab.in_use, state_slab.capacity,
+                          state_slab.peak, state_slab.full,
+                          state_slab.obj_size * state_slab.capacity,
+                          state_slab.obj_size,
+                          body_slab.in_use, body_slab.capacity, body_slab.full,
+                          batch_slab.in_use, batch_slab.capacity, batch_slab.full,
+                          static_asset_count(), static_reload_count(),
+                          total.requests, total.loop_waits,
+                          total.accept_total, total.accept_shed,
+                          total.entry_hit, total.entry_miss,
+                          total.batch_hit, total.batch_miss,
+                          total.static_hit, total.static_miss,
+                          total.error_4xx, total.error_5xx,
+                          total.bytes_in, total.bytes_out,
+                          total.partial_writes, total.write_eagain,
+                          total.entry_copy, total.entry_copy_bytes,
+                          total.entry_sendfile, total.entry_sendfile_bytes,
+                          total.entry_sent[ENC_IDENTITY], total.entry_sent[ENC_GZIP],
+                          total.entry_sent[ENC_BR], total.entry_sent[ENC_ZSTD],
+                          total.entry_inflated, total.not_modified,
+                          total.timeout_count[TIMER_HEADER],
+                          total.timeout_count[TIMER_IDLE],
+                          total.timeout_count[TIMER_WRITE],
+                          *log_level, total.log_dropped, total.access_records,
+                          (unsigned long)generation, db->search.word_count,
+                          reload_failed, retiring, resident_mode_name(),
+                          (long)db->search.size,
+                          (unsigned long)resident_bytes(db->search.data,
+                                                        db->search.size),
+                          db->search.locked, resident_huge_bytes());
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        histogram *h = total.latency + r;
+        length += snprintf(body + length, BATCH_BUFSIZE - length,
+                           "requests_%s %ld\n"
+                           "latency_%s_p50_us %ld\n"
+                           "latency_%s_p90_us %ld\n"
+                           "latency_%s_p99_us %ld\n"
+                           "latency_%s_p999_us %ld\n"
+                           "latency_%s_max_us %ld\n",
+                           route_names[r], total.route_requests[r],
+                           route_names[r], hist_percentile(h, 0.5),
+                           route_names[r], hist_percentile(h, 0.9),
+                           route_names[r], hist_percentile(h, 0.99),
+                           route_names[r], hist_percentile(h, 0.999),
+                           route_names[r], h->max);
+    }
+    if (http_query_int(&ptr->req, "hist", 0)) {
+        for (int r = 0; r < ROUTE_COUNT; r++) {
+            char name[32];
+            sprintf(name, "bucket_%s", route_names[r]);
+            length += hist_buckets(total.latency + r, name, body + length,
+                                   BATCH_BUFSIZE - length);
+        }
+    }
+    send_dynamic(ptr, "text/plain", "no-cache", length);
+}
+
+// /p/:prefix?n=N, JSON array of best N words start with prefix
+static void serve_complete(dict_epoll_data *ptr, char *prefix) {
+    int result[TOP_K];
+    int count = complete(prefix, http_query_int(&ptr->req, "n", 10), result);
+    char *body = body_buffer(ptr);
+    if (!body) { return; }
+    int length = json_word_list(result, count, body, DYN_BUFSIZE);
+    send_dynamic(ptr, "application/json", "max-age=86400, public", length);
+}
+
+// /s/:word?n=N, JSON array of best N words within edit distance 2
+static void serve_suggest(dict_epoll_data *ptr, char *word) {
+    int result[MAX_SUGGEST];
+    int count = suggest(word, http_query_int(&ptr->req, "n", 10), result);
+    char *body = body_buffer(ptr);
+    if (!body) { return; }
+    int length = json_word_list(result, count, body, DYN_BUFSIZE);
+    send_dynamic(ptr, "application/json", "max-age=86400, public", length);
+}
+
+// /b/w1,w2,... JSON array of the words' explanations, null if not
+// found. One request, one search_batch, one writev
+static void serve_batch(dict_epoll_data *ptr, char *words) {
+    char *targets[MAX_BATCH];
+    int indexes[MAX_BATCH], count = 0, iov_cnt;
+    char *p = words;
+    while (*p) {                // split in place
+        char *comma = strchr(p, ',');
+        if (comma) { *comma = '\0'; }
+        if (*p) {
+            if (count == MAX_BATCH) {
+                reply_error(ptr, 414, "URI Too Long");
+                return;
             }
+            targets[count++] = p;
+        }
+        if (!comma) { break; }
+        p = comma + 1;
+    }
+    search_batch(targets, count, indexes);
+    for (int i = 0; i < count; i++) {
+        if (indexes[i] >= 0) {
+            stats->batch_hit++;
+        } else {
+            stats->batch_miss++;
+        }
+    }
+    char *buf = pool_buffer(ptr, &batch_slab);
+    if (!buf) { return; }
+    struct iovec *iov = (struct iovec*)buf;
+    int data_off = sizeof(struct iovec) * BATCH_IOV;
+    int length = batch_body(indexes, count, buf + data_off,
+                            BATCH_BUFSIZE - data_off, iov + 1, BATCH_IOV - 1,
+                            &iov_cnt);
+    if (length < 0) {
+        release_body(ptr);
+        reply_error(ptr, 413, "Payload Too Large");
+        return;
+    }
+    iov[0].iov_base = ptr->headers;
+    iov[0].iov_len = sprintf(ptr->headers, dynamic_headers, length,
+                             "max-age=86400, public", "application/json",
+                             conn_header(ptr));
+    ptr->iov_ext = iov;
+    ptr->iov_idx = 0;
+    ptr->iov_cnt = iov_cnt + 1;
+    send_response(ptr);
+}
+
+static char *not_modified_headers = "HTTP/1.1 304 Not Modified\r\nETag: %.*s\r\nCache-Control: max-age=86400, public\r\n%s%s\r\n";
+
+// 304, client's copy is still good
+void send_not_modified(dict_epoll_data *ptr, char *etag, int etag_len,
+                       int vary) {
+    stats->not_modified++;
+    ptr->status = 304;
+    ptr->iov[0].iov_base = ptr->headers;
+    ptr->iov[0].iov_len = sprintf(ptr->headers, not_modified_headers,
+                                  etag_len, etag,
+                                  vary ? "Vary: Accept-Encoding\r\n" : "",
+                                  conn_header(ptr));
+    ptr->iov_idx = 0;
+    ptr->iov_cnt = 1;
+    send_response(ptr);
+}
+
+static char *inflated_headers = "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nCache-Control: max-age=86400, public\r\nContent-Type: application/json\r\nVary: Accept-Encoding\r\nETag: %s\r\n%s\r\n";
+
+// client can not take any stored variant, inflate the gzip one. ETag
+// is the gzip one's, marked
+static void serve_inflated(dict_epoll_data *ptr, int index) {
+    char etag[ETAG_LEN + 3];
+    word_variant *gzip = get_response(index, ACCEPT_GZIP);
+    if (!gzip) {
+        reply_error(ptr, 500, "Internal Server Error");
+        return;
+    }
+    sprintf(etag, "%.*s-i\"", ETAG_LEN - 1, gzip->etag);
+    if (http_not_modified(&ptr->req, etag, ETAG_LEN + 2, 0)) {
+        send_not_modified(ptr, etag, ETAG_LEN + 2, 1);
+        return;
+    }
+    char *buf = pool_buffer(ptr, &batch_slab);
+    if (!buf) { return; }
+    int length = inflate_entry(index, buf, BATCH_BUFSIZE);
+    if (length < 0) {
+        release_body(ptr);
+        reply_error(ptr, 500, "Internal Server Error");
+        return;
+    }
+    stats->entry_inflated++;
+    ptr->iov[0].iov_base = ptr->headers;
+    ptr->iov[0].iov_len = sprintf(ptr->headers, inflated_headers, length,
+                                  etag, conn_header(ptr));
+    ptr->iov[1].iov_base = buf;
+    ptr->iov[1].iov_len = length;
+    ptr->iov_idx = 0;
+    ptr->iov_cnt = 2;
+    send_response(ptr);
+}
+
+// /d/:word, smallest variant the client accept. All precomputed, one
+// writev, or headers then sendfile
+static void serve_entry(dict_epoll_data *ptr, int index) {
+    word_variant *resp = get_response(index, ptr->req.accept_enc);
+    if (!resp) {
+        serve_inflated(ptr, index);
+        return;
+    }
+    if (http_not_modified(&ptr->req, resp->etag, ETAG_LEN, 0)) {
+        send_not_modified(ptr, resp->etag, ETAG_LEN, 1);
+        return;
+    }
+    struct iovec *iov = ptr->iov;
+    char *conn = conn_header(ptr);
+    stats->entry_sent[resp->encoding]++;
+    iov->iov_base = STATUS_200;
+    iov->iov_len = sizeof(STATUS_200) - 1;
+    iov++;
+    if (conn[0]) {
+        iov->iov_base = conn;
+        iov->iov_len = strlen(conn);
+        iov++;
+    }
+    iov->iov_base = resp->headers;
+    iov->iov_len = resp->headers_cnt;
+    iov++;
+    if (resp->body_cnt >= sendfile_min) {
+        // big one: from page cache, no copy, no page fault
+        ptr->file_fd = data_fd();
+        ptr->file_offset = data_offset(resp->body);
+        ptr->file_cnt = resp->body_cnt;
+        stats->entry_sendfile++;
+        stats->entry_sendfile_bytes += resp->body_cnt;
+    } else {
+        iov->iov_base = resp->body;
+        iov->iov_len = resp->body_cnt;
+        iov++;
+        stats->entry_copy++;
+        stats->entry_copy_bytes += resp->body_cnt;
+    }
+    ptr->iov_idx = 0;
+    ptr->iov_cnt = iov - ptr->iov;
+    send_response(ptr);
+}
+
+// uri point into request buffer, \0 terminated
+void handle_request(dict_epoll_data *ptr, char *uri, int uri_length) {
+    if (uri_length > 3 && uri[0] == '/' && uri[1] == 'd' && uri[2] == '/') {
+        int index = search_index(uri + 3); // 3 is /d/:word
+        ptr->route = ROUTE_ENTRY;
+        if (index >= 0) {
+            stats->entry_hit++;
+            serve_entry(ptr, index);
         } else {
-            client_error(ptr->sock_fd, 404, "Not found", "");
+            stats->entry_miss++;
+            reply_error(ptr, 404, "Not found");
         }
+    } else if (uri_length >= 3 && uri[0] == '/' && uri[1] == 'p' && uri[2] == '/') {
+        ptr->route = ROUTE_COMPLETE;
+        serve_complete(ptr, uri + 3);
+    } else if (uri_length >= 3 && uri[0] == '/' && uri[1] == 'b' && uri[2] == '/') {
+        ptr->route = ROUTE_BATCH;
+        serve_batch(ptr, uri + 3);
+    } else if (uri_length >= 3 && uri[0] == '/' && uri[1] == 's' && uri[2] == '/') {
+        ptr->route = ROUTE_SUGGEST;
+        serve_suggest(ptr, uri + 3);
+    } else if (strcmp(uri, "/stats") == 0) {
+        ptr->route = ROUTE_STATS;
+        serve_stats(ptr);
     } else {
-        uri = uri + 1;
-        int uri_length = strlen(uri);
-        if (uri_length == 0) {
+        ptr->route = ROUTE_STATIC;
+        uri++;                  // relative to document root
+        if (uri[0] == '\0') {
 #ifdef PRODUCTION
-            uri = "dict.html.gz";
+            uri = "dict.html";
 #endif
 #ifndef PRODUCTION
             uri = "index.html";
 #endif
         }
-#ifdef PRODUCTION
-        else if (uri[uri_length-2] == 'j' && uri[uri_length-1] == 's') {
-            strcat(uri, ".gz"); // use gziped js, uri is large enough
+        LOGS(LOG_DEBUG, uri, "request file %s, sock_fd %ld", ptr->sock_fd);
+        if (serve_file(ptr, uri)) {
+            stats->static_hit++;
+        } else {
+            stats->static_miss++; // 404 is sent
         }
-#endif
-#ifdef DEBUG
-        printf("sock_fd %d, request file %s\n", ptr->sock_fd, uri);
-#endif
-        serve_file(ptr, uri);
     }
+    stats->route_requests[ptr->route]++;
 }
 
-void process_request(dict_epoll_data *ptr, int epollfd) {
-    rio_t rio;
-    char buf[MAXLINE], method[16], uri[MAXLINE];
-    rio_readinitb(&rio, ptr->sock_fd);
-    int c = rio_readlineb(&rio, buf, MAXLINE);
-    if (c > 0) {
-        sscanf(buf, "%s %s", method, uri); // http version is not cared
-#ifdef DEBUG
-        printf("method: %s, uri: %s, count: %d, line: %s", method, uri, c, buf);
-#endif
-        // read all
-        while(buf[0] != '\n' && buf[1] != '\n') { // \n || \r\n
-            c = rio_readlineb(&rio, buf, MAXLINE);
-            if (c == -1) { break; }
-            else if (c == 0 ) { // EOF, remote close conn
-#ifdef DEBUG
-                printf("reading header: clean, close sock_fd %d\n", ptr->sock_fd); //
-#endif
-                close_and_clean(ptr, epollfd);
-                return;
+// answer buffered requests in order, one response in flight at a time.
+// return 0 if connection is closed
+static int serve_pipelined(dict_epoll_data *ptr, int epollfd) {
+    http_request *req = &ptr->req;
+    while (!response_pending(ptr)) {
+        int r = http_parse(req);
+        if (r == HTTP_AGAIN) {
+            int before = req->cnt - req->start; // same after compaction
+            int c = use_uring ? uring_fill(ptr) : http_fill(req, ptr->sock_fd);
+            stats->bytes_in += req->cnt - req->start - before;
+            r = http_parse(req);
+            if (r == HTTP_AGAIN) {
+                if (c > 0) {
+                    return 1;   // wait for more bytes
+                }
+                LOG(LOG_DEBUG, "reading request: clean, close sock_fd %ld",
+                    ptr->sock_fd);
+                close_and_clean(ptr->conn, epollfd); // EOF, remote close conn
+                return 0;
             }
         }
-        url_decode(uri, buf, MAXLINE);
-        #ifdef DEBUG
-            printf("url_decode\n");
-        #endif
-        handle_request(ptr, buf); // reuse buffer
-    } else if (c == 0) {       // EOF, remote close conn
-#ifdef DEBUG
-        printf("reading line: clean, close sock_fd %d\n", ptr->sock_fd);
-#endif
-        close_and_clean(ptr, epollfd);
+        stats->requests++;
+        ptr->req_start = now_us();
+        ptr->status = 200;
+        ptr->sent = 0;
+        ptr->db = db_hold();
+        if (r == HTTP_ERROR || r == HTTP_TOO_LARGE) {
+            // nothing after it can be framed: close once it is written
+            req->keep_alive = 0;
+            ptr->route = ROUTE_STATIC;
+            access_begin(&alog, &ptr->access, ptr->conn->client, "", 0);
+            if (r == HTTP_ERROR) {
+                reply_error(ptr, 400, "Bad Request");
+            } else {
+                reply_error(ptr, 431, "Request Header Fields Too Large");
+            }
+        } else {
+            LOGS(LOG_DEBUG, req->path.ptr, "uri: %s, sock_fd %ld", ptr->sock_fd);
+            access_begin(&alog, &ptr->access, ptr->conn->client,
+                         req->path.ptr, req->path.len);
+            handle_request(ptr, req->path.ptr, req->path.len);
+        }
+        if (!response_pending(ptr) && !finish_response(ptr, epollfd)) {
+            return 0;
+        }
     }
+    return 1;
 }
 
-void write_response(dict_epoll_data *ptr, int epollfd) {
-    if (ptr->headers_cnt) {
-        char *bufp = ptr->headers_bufptr;
-        int cont = nonb_write_headers(ptr->sock_fd, bufp, strlen(bufp), ptr);
-        if (cont) {
-            bufp = ptr->body_bufptr;
-            nonb_write_body(ptr->sock_fd, bufp, strlen(bufp), ptr);
-        }
-    } else if (ptr->body_cnt) {
-        char *bufp = ptr->body_bufptr;
-        nonb_write_body(ptr->sock_fd, bufp, strlen(bufp), ptr);
+int process_request(dict_epoll_data *ptr, int epollfd) {
+    return serve_pipelined(ptr, epollfd);
+}
+
+int write_response(dict_epoll_data *ptr, int epollfd) {
+    if (!response_pending(ptr)) {
+        return 1;
     }
-    if (ptr->file_cnt) {
+    if (nonb_writev(ptr) && ptr->file_cnt) {
         nonb_sendfile(ptr);
     }
+    if (response_pending(ptr)) {
+        return 1;
+    }
+    // this one is done, the next pipelined request can go
+    return finish_response(ptr, epollfd) && serve_pipelined(ptr, epollfd);
 }
 
 void enter_loop(int listen_sock, int epollfd) {
@@ -249,97 +968,540 @@ void enter_loop(int listen_sock, int epollfd) {
     uint32_t events;
     struct epoll_event epoll_events[MAX_EVENTS];
     while(1) {
-        nfds = epoll_wait(epollfd, epoll_events, MAX_EVENTS, -1);
-#ifdef VERBOSE
-        printf("epoll wait return %d events\n", nfds);
-#endif
+        // wake each tick while any connection has a deadline
+        db_leave();             // a reload need not wait for us
+        nfds = epoll_wait(epollfd, epoll_events, MAX_EVENTS,
+                          wheel.count ? TIMER_TICK_MS : -1);
+        db_enter();
+        stats->loop_waits++;
+        LOG(LOG_TRACE, "epoll wait return %ld events", nfds);
         for (int i = 0; i < nfds; ++ i) {
             events = epoll_events[i].events;
             if (epoll_events[i].data.fd == listen_sock) {
                 accept_incoming(listen_sock, epollfd);
-            }  else {
-                dict_epoll_data *ptr = (dict_epoll_data*) epoll_events[i].data.ptr;
+            } else if (epoll_events[i].data.fd == static_watch_fd()) {
+                static_changed();
+            } else {
+                dict_conn *conn = (dict_conn*) epoll_events[i].data.ptr;
                 if ((events & EPOLLERR)) {
-#ifdef DEBUG
-                    printf("error condiction, events: %d, fd: %d\n",
-                           events, ptr->sock_fd);
-#endif
-                    close_and_clean(ptr, epollfd);
+                    LOG(LOG_DEBUG, "error condiction, events: %ld, fd: %ld",
+                        events, conn->sock_fd);
+                    close_and_clean(conn, epollfd);
                 } else {
                     if (events & EPOLLIN) {
-#ifdef DEBUG
-                        printf("process request, sock_fd %d\n", ptr->sock_fd);
-#endif
-                        process_request(ptr, epollfd);
+                        LOG(LOG_TRACE, "process request, sock_fd %ld", conn->sock_fd);
+                        if (!conn->state && !acquire_state(conn)) {
+                            // all busy, -a to raise
+                            send_error(conn->sock_fd, 503, "Service Unavailable");
+                            close_and_clean(conn, epollfd);
+                            continue;
+                        }
+                        if (!process_request(conn->state, epollfd)) {
+                            continue; // closed, conn is freed
+                        }
                     }
-                    
-                    if (events & EPOLLOUT) {
-                        printf("EPOLLOUT sock_fd: %d write\n",ptr->sock_fd);
-                        write_response(ptr, epollfd);
+
+                    if ((events & EPOLLOUT) && conn->state) {
+                        LOG(LOG_TRACE, "EPOLLOUT sock_fd: %ld write", conn->sock_fd);
+                        if (!write_response(conn->state, epollfd)) {
+                            continue;
+                        }
                     }
+                    update_timer(conn);
                 }
             }
         }
+        expire_timers(epollfd);
     }
 }
 
 
-int shart_child(int i){
+// after a completion of conn: recv again if it wait for a request
+static void uring_update(dict_conn *conn) {
+    dict_epoll_data *ptr = conn->state;
+    update_timer(conn);         // idle: state is given back
+    if (!conn->uring_recv && !conn->uring_ops &&
+        !(ptr && (response_pending(ptr) || ptr->held_len))) {
+        uring_recv(conn);
+    }
+}
 
-    pid_t pid;
-    if( (pid = fork()) < 0 ){
-         perror("fork err");
-         return 0;
-    }else if (pid == 0){
-        //in child
-
-        printf("child pid %d %d c:%d\n", pid,i,getpid());
-        return i;
-    }else{
-        //in parent
-        printf("parent fork child pid %d %d c:%d\n", pid,i,getpid());
+static void unpark(dict_conn *conn) {
+    for (int i = 0; i < parked_cnt; i++) {
+        if (parked[i] == conn) {
+            parked[i] = parked[--parked_cnt];
+            break;
+        }
+    }
+    conn->uring_recv = 0;
+}
+
+// one parked connection recv again for each buffer given back since
+// last round. Not before: a recv with none out return at once
+static void rearm_parked() {
+    unsigned short back = ring.buf_tail - buf_seen;
+    buf_seen = ring.buf_tail;
+    while (back-- && parked_cnt) {
+        dict_conn *conn = parked[--parked_cnt];
+        conn->uring_recv = 0;
+        uring_recv(conn);
+    }
+}
+
+// bytes of a recv are in a provided buffer. Return 0 if conn is closed
+static int uring_received(dict_conn *conn, int res, unsigned flags) {
+    if (res == -ENOBUFS) {      // all out, parked till one is back
+        conn->uring_recv = URING_PARKED;
+        parked[parked_cnt++] = conn;
+        return 1;
+    }
+    if (res <= 0) {
+        LOG(LOG_DEBUG, "reading request: clean, close sock_fd %ld", conn->sock_fd);
+        close_and_clean(conn, -1); // EOF, remote close conn
+        return 0;
+    }
+    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (!conn->state && !acquire_state(conn)) {
+        uring_recycle(&ring, bid); // all busy, -a to raise
+        send_error(conn->sock_fd, 503, "Service Unavailable");
+        close_and_clean(conn, -1);
         return 0;
     }
+    conn->state->held_bid = bid;
+    conn->state->held_off = 0;
+    conn->state->held_len = res;
+    return serve_pipelined(conn->state, -1);
+}
 
+// a request of conn is done. A send chain goes on when all of its
+// requests are done
+static void uring_complete(dict_conn *conn, int tag, int res, unsigned flags) {
+    dict_epoll_data *ptr = conn->state;
+    conn->uring_ops--;
+    if (tag == UR_RECV) {
+        conn->uring_recv = 0;
+    }
+    if (conn->sock_fd < 0) {    // closed, wait for the last one
+        if (flags & IORING_CQE_F_BUFFER) {
+            uring_recycle(&ring, flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        if (!conn->uring_ops) {
+            free_conn(conn);
+        }
+        return;
+    }
+    if (tag == UR_RECV) {
+        if (uring_received(conn, res, flags)) {
+            uring_update(conn);
+        }
+        return;
+    }
+    if (res > 0) {
+        if (tag == UR_SEND) {
+            iov_advance(ptr, res);
+            stats->bytes_out += res;
+            ptr->sent += res;
+        } else if (tag == UR_SPLICE_IN) {
+            ptr->file_cnt -= res;
+            ptr->file_offset += res;
+            ptr->pipe_cnt += res;
+        } else if (tag == UR_SPLICE_OUT) {
+            ptr->pipe_cnt -= res;
+            stats->bytes_out += res;
+            ptr->sent += res;
+            if (ptr->pipe_cnt) {
+                stats->partial_writes++;
+            }
+        }
+    } else if (res == -EAGAIN) {
+        ptr->uring_wait = 1;    // socket full
+        stats->write_eagain++;
+    } else if (res != -ECANCELED) { // an earlier one of the chain failed
+        LOGS(LOG_DEBUG, strerror(-res), "io_uring: %s, tag %ld, close sock_fd %ld",
+             tag, conn->sock_fd);
+        close_and_clean(conn, -1); // peer gone, or file truncated
+        return;
+    }
+    if (conn->uring_ops) {
+        update_timer(conn);     // it moves
+        return;
+    }
+    if (tag == UR_POLL && ptr->pipe_idx < 0 && ptr->file_cnt) {
+        nonb_sendfile(ptr);     // no pipe was free
+    }
+    if (response_pending(ptr)) {
+        uring_send(ptr);
+    } else if (!finish_response(ptr, -1) || !serve_pipelined(ptr, -1)) {
+        return;                 // closed
+    }
+    uring_update(conn);
 }
 
-void fork_processes(int number){
-    int child_id;
-    for(int i=1;i<=number;i++){
-          child_id = shart_child(i);
-          if(child_id != 0){
-              return;
-          }
+static void uring_accept(int listen_sock) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_sock;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT; // one sqe, every connection
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = UR_ACCEPT;
+}
+
+static void uring_watch() {
+    struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = static_watch_fd();
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = UR_WATCH;
+}
+
+// one io_uring_enter a round: submit all queued, wait for completions
+static void enter_uring_loop(int listen_sock) {
+    struct io_uring_cqe *cqe;
+    uring_accept(listen_sock);
+    uring_watch();
+    while (1) {
+        // wake each tick while any connection has a deadline
+        db_leave();
+        uring_submit_and_wait(&ring, wheel.count ? TIMER_TICK_MS : -1);
+        db_enter();
+        stats->loop_waits++;
+        while ((cqe = uring_peek_cqe(&ring))) {
+            unsigned long data = cqe->user_data;
+            int res = cqe->res, tag = data & UR_TAG_MASK;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&ring); // seen first: handling may submit
+            if (tag == UR_ACCEPT) {
+                if (res >= 0) {
+                    LOG(LOG_DEBUG, "accept sock_fd is %ld", res);
+                    dict_conn *conn = new_conn(res, peer_addr(res));
+                    if (conn) {
+                        uring_recv(conn);
+                    }
+                } else if (res == -EMFILE || res == -ENFILE) {
+                    shed_connection(listen_sock);
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    uring_accept(listen_sock);
+                }
+            } else if (tag == UR_WATCH) {
+                static_changed();
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    uring_watch();
+                }
+            } else {
+                uring_complete((dict_conn*)(data & ~(unsigned long)UR_TAG_MASK),
+                               tag, res, flags);
+            }
+        }
+        expire_timers(-1);
+        rearm_parked();
+    }
+}
+
+// io_uring with multishot accept and provided buffers, 5.19+. 0 if ok
+static int init_uring() {
+    if (uring_init(&ring, URING_ENTRIES)) {
+        return -1;
     }
+    if (uring_provide_buffers(&ring, 0, URING_BUFS, URING_BUF_SIZE) ||
+        !(parked = malloc(sizeof(dict_conn*) * max_conns))) {
+        close(ring.fd);
+        return -1;
+    }
+    buf_seen = ring.buf_tail;
+    return 0;
+}
 
+// of the master, SIGHUP is passed to them. NULL in a worker
+static volatile pid_t *children;
+static int child_count;
 
-    printf("parent wait c:%d\n",getpid());
-    //in parent
-    int status;
-    pid_t  ex_pid = wait(&status);
-    perror("pid return\n");
+// SIGHUP waits while there is no db to reload yet, or no worker to
+// pass it to
+static void block_reload(int how) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigprocmask(how, &set, NULL);
 }
 
+// the child start with SIGHUP blocked, till it has made its db
+static pid_t start_child(int i) {
+    pid_t pid;
+    fflush(stdout);             // or child print it again
+    block_reload(SIG_BLOCK);
+    if ((pid = fork()) < 0) {
+        perror("fork err");
+        exit(EXIT_FAILURE);
+    } else if (pid > 0) {
+        block_reload(SIG_UNBLOCK);
+    } else {
+        children = NULL;
+        printf("worker %d started, pid %d\n", i, getpid());
+    }
+    return pid;
+}
 
-int main(int argc, char** argv) {
-    struct epoll_event ev;
-    int listen_sock, efd;
+// return in child with its worker id, 1 based. The parent stay here
+// and restart any worker that die
+static int fork_processes(int number) {
+    pid_t pids[number];
+    memset(pids, 0, sizeof(pids));
+    child_count = number;
+    children = pids;
+    for (int i = 1; i <= number; i++) {
+        if ((pids[i - 1] = start_child(i)) == 0) {
+            return i;
+        }
+    }
+    while (1) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) { continue; }
+            perror("wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 1; i <= number; i++) {
+            if (pids[i - 1] == pid) {
+                printf("worker %d, pid %d exit, status %d, restart\n",
+                       i, pid, status);
+                if ((pids[i - 1] = start_child(i)) == 0) {
+                    return i;
+                }
+            }
+        }
+    }
+}
+
+// SIGHUP: the master pass it to its workers, each process reload its
+// own copy. Only sem_post here
+static void reload_signal(int sig) {
+    if (children) {
+        for (int i = 0; i < child_count; i++) {
+            if (children[i] > 0) {
+                kill(children[i], SIGHUP);
+            }
+        }
+    } else {
+        db_reload();
+    }
+}
 
-    listen_sock = open_nonb_listenfd(9090);
+static void handle_reload() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = reload_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+}
+
+// one worker, id is 1 based: its own listen socket (or the shared
+// one), pools, timer wheel and event loop. Never return
+static void* run_worker(void *arg) {
+    struct epoll_event ev;
+    int listen_sock = shared_listen, efd;
+    worker_id = (long)arg;
+    stats = all_stats + worker_id - 1;
+    log_attach(worker_id, &stats->log_dropped);
+    db_attach();
+    db_enter();
+    if (reuseport) {
+        listen_sock = open_reuseport_listenfd(port);
+    }
+    slab_init(&conn_slab, sizeof(dict_conn), max_conns);
+    slab_init(&state_slab, sizeof(dict_epoll_data), max_active);
+    timer_init(&wheel);
+    slab_init(&body_slab, DYN_BUFSIZE, max_conns / 16 + 64);
+    slab_init(&batch_slab, BATCH_BUFSIZE, max_conns / 1024 + 8);
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (access_prefix &&
+        access_open(&alog, access_prefix, worker_id, access_sample)) {
+        perror("access log, off");
+    }
+    use_uring = want_uring;
+    if (use_uring && init_uring()) {
+        perror("io_uring, use epoll");
+        use_uring = 0;
+    }
+    init_static();
+    fflush(stdout);             // lines of start, the log writer write past stdio
+    if (use_uring) {
+        enter_uring_loop(listen_sock);
+    }
 
-    //fork load balance server
-    fork_processes(2);
-    
     efd = epoll_create(100);
     if (efd == -1) { perror("epoll_create"); exit(EXIT_FAILURE); }
 
     ev.events = EPOLLIN;        // read
+#ifdef EPOLLEXCLUSIVE
+    if (!reuseport) {
+        ev.events |= EPOLLEXCLUSIVE;
+    }
+#endif
     ev.data.fd = listen_sock;
     if (epoll_ctl(efd, EPOLL_CTL_ADD, listen_sock, &ev) == -1) {
         perror("epoll_ctl: listen_sock");
         exit(EXIT_FAILURE);
     }
-    init_dict_search();
+    ev.events = EPOLLIN;
+    ev.data.fd = static_watch_fd();
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, static_watch_fd(), &ev) == -1) {
+        perror("epoll_ctl: static_watch_fd");
+        exit(EXIT_FAILURE);
+    }
     enter_loop(listen_sock, efd);
+    return NULL;
+}
+
+// -T: workers are threads of this process, each pinned to one of the
+// cores it may run on. The caller has made the dictionary, its indexes
+// and responses once, they are shared read only. Never return
+static void start_threads(int number) {
+    pthread_t tids[number];
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE], ncpu = 0;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &allowed)) { cpus[ncpu++] = c; }
+    }
+    for (long i = 1; i <= number; i++) {
+        pthread_attr_t attr;
+        cpu_set_t set;
+        pthread_attr_init(&attr);
+        CPU_ZERO(&set);
+        CPU_SET(cpus[(i - 1) % ncpu], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        if (pthread_create(tids + i - 1, &attr, run_worker, (void*)i)) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        printf("worker %ld started, cpu %d\n", i, cpus[(i - 1) % ncpu]);
+        pthread_attr_destroy(&attr);
+    }
+    for (int i = 0; i < number; i++) { // they never return
+        pthread_join(tids[i], NULL);
+    }
+    exit(EXIT_FAILURE);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-p port] [-w workers] [-T] [-i hash|bsearch|eytzinger]"
+            " [-c max_conns] [-a max_active]\n"
+            "       [-f word_freq_file] [-z sendfile_min_bytes]"
+            " [-t header:idle:write timeouts]\n"
+            "       [-e epoll|uring] [-l error|warn|info|debug|trace]"
+            " [-A access_log_prefix[:sample]]\n"
+            "       [-m lazy|populate|lock]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    int opt, threads = 0, workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int index_type = INDEX_HASH, level = LOG_INFO;
+    int residency = RESIDENT_POPULATE;
+    char *freq_file = NULL;
+
+    while ((opt = getopt(argc, argv, "p:w:Ti:c:a:f:z:t:e:l:A:m:")) != -1) {
+        switch (opt) {
+        case 'e':
+            if (strcmp(optarg, "uring") == 0) {
+                want_uring = 1;
+            } else if (strcmp(optarg, "epoll") != 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            if ((level = log_level_of(optarg)) < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'A': {
+            char *colon = strrchr(optarg, ':');
+            if (colon) {        // 1 in sample requests
+                *colon = '\0';
+                if ((access_sample = atoi(colon + 1)) < 1) {
+                    usage(argv[0]);
+                }
+            }
+            access_prefix = optarg;
+            break;
+        }
+        case 'm':
+            if ((residency = resident_mode_of(optarg)) < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'f': freq_file = optarg; break;
+        case 'z': sendfile_min = atoi(optarg); break;
+        case 't':
+            if (sscanf(optarg, "%d:%d:%d", timeouts + TIMER_HEADER,
+                       timeouts + TIMER_IDLE, timeouts + TIMER_WRITE) != 3) {
+                usage(argv[0]);
+            }
+            break;
+        case 'c': max_conns = atoi(optarg); break;
+        case 'a': max_active = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'w': workers = atoi(optarg); break;
+        case 'T': threads = 1; break;
+        case 'i':
+            if (strcmp(optarg, "hash") == 0) {
+                index_type = INDEX_HASH;
+            } else if (strcmp(optarg, "bsearch") == 0) {
+                index_type = INDEX_BSEARCH;
+            } else if (strcmp(optarg, "eytzinger") == 0) {
+                index_type = INDEX_EYTZINGER;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        default: usage(argv[0]);
+        }
+    }
+    if (workers < 1 || max_conns < 1 || max_active < 0) { usage(argv[0]); }
+    if (!max_active) {          // most are idle, they only have a dict_conn
+        max_active = max_conns / 4 + 64;
+    }
+    if (max_active > max_conns) { max_active = max_conns; }
+    signal(SIGPIPE, SIG_IGN);   // sendfile to a closed socket
+    log_init(level);            // SIGUSR1 and SIGUSR2 change it later
+    if (access_prefix) {
+        access_init();
+    }
+
+    // SO_REUSEPORT: one socket per worker, kernel balance, no thundering
+    // herd. Or all share one, EPOLLEXCLUSIVE wake only one of them
+    reuseport = reuseport_supported();
+    if (!reuseport) {
+        shared_listen = open_nonb_listenfd(port);
+    }
+    printf("listen on %d, %d %s, %s\n", port, workers,
+           threads ? "threads" : "workers",
+           reuseport ? "SO_REUSEPORT" : "shared socket");
+    worker_total = workers;
+    all_stats = mmap(NULL, sizeof(worker_stats) * workers,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (all_stats == MAP_FAILED) {
+        perror("mmap stats");
+        exit(EXIT_FAILURE);
+    }
+
+    resident_init(residency);   // of dbdata, at start and every reload
+    block_reload(SIG_BLOCK);
+    handle_reload();            // SIGHUP, dbdata is made again
+    if (threads) {              // made once, for all
+        db_init(index_type, freq_file);
+        block_reload(SIG_UNBLOCK);
+        start_threads(workers);
+    }
+    //fork load balance server, each make its own
+    long id = fork_processes(workers);
+    db_init(index_type, freq_file);
+    block_reload(SIG_UNBLOCK);
+    run_worker((void*)id);
     return 0;
 }
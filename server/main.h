@@ -15,44 +15,112 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include "accesslog.h"
+#include "dictdb.h"
+#include "http.h"
+#include "log.h"
+#include "slab.h"
+#include "stats.h"
+#include "timer.h"
+#include "uring.h"
+
+struct static_asset;
 
 #define MAXLINE 512             // max length of a line
 #define MAX_EVENTS 256
-#define RESP_HEADER_LENTH 152
+#define ACCEPT_BUDGET 64        // max accept per listen socket event
+#define RESP_HEADER_LENTH 256
+#define RESP_IOV 4              // status, Connection, headers, body
+#define DYN_BUFSIZE 4096        // body of generated response
+#define TIMER_HEADER 1          // a request is coming, not all here
+#define TIMER_IDLE 2            // keep-alive, nothing to do
+#define TIMER_WRITE 3           // response blocked by client
+#define UR_ACCEPT 1             // io_uring user_data tag, low bits
+#define UR_WATCH 2              // static files changed
+#define UR_RECV 3
+#define UR_SEND 4
+#define UR_SPLICE_IN 5          // file to pipe
+#define UR_SPLICE_OUT 6         // pipe to socket
+#define UR_POLL 7               // socket writable
+#define UR_TAG_MASK 15          // dict_conn is 16 byte aligned
+#define SENDFILE_MIN 16384      // entry this big is sendfile, not copied
+#define MAX_BATCH 128           // words of a /b/ request
+#define BATCH_IOV (2 * MAX_BATCH + 3) // headers, [, entries and , ]
+#define BATCH_BUFSIZE (256 * 1024) // iovecs, then inflated entries
+#define URING_ENTRIES 4096      // submission queue
+#define URING_BUFS 4096         // provided recv buffers, power of 2
+#define URING_BUF_SIZE 1024     // a request or part of it
+#define URING_PIPES 64          // for splice, file to pipe to socket
+#define PIPE_CHUNK 65536        // default pipe capacity
+#define URING_PARKED 2          // recv got no buffer, wait for one back
 
 // #define TEST_EPOLL
 
-#define DEBUG
-// #define VERBOSE
 
-#ifdef VERBOSE
-#ifndef DEBUG
-#define DEBUG
-#endif
-#endif
+struct dict_conn;
 
-// sizeof = 168, malloc: 176
+// in flight state of a connection: request being read, response being
+// written. From a per worker pool, only while there is something to do.
+// sizeof = 2760
 typedef struct {
-    char* body_bufptr;          // offset in dict array data
+    struct dict_conn *conn;     // it belongs to
     int sock_fd;                // file descriptor
-    int body_cnt;               // how remainning byte
+    int iov_cnt;                // how many iovec unwrite
+    int iov_idx;                // first unwrite iovec
+    struct iovec iov[RESP_IOV]; // point to headers, or dict array data
+    struct iovec *iov_ext;      // used instead of iov if set, in body_buf
 
-    char headers[RESP_HEADER_LENTH];
-    char *headers_bufptr;       // header pointer
-    int headers_cnt;            // header length unwrite
-    int static_fd;
+    char headers[RESP_HEADER_LENTH]; // formatted, for static file
+    char *body_buf;             // from pool, while generated body in flight
+    slab *body_pool;            // body_buf is from
+    struct static_asset *asset; // static file in flight, released after
+    int file_fd;                // sendfile from, asset's or dbdata's
     int file_cnt;               // unwrite file
     off_t file_offset;
+
+    // io_uring only
+    struct msghdr msg;          // of the sendmsg in flight
+    int pipe_idx;               // splice through, -1 if none
+    int pipe_cnt;               // spliced in, not yet out
+    int held_bid;               // provided buffer not all taken by req
+    int held_off, held_len;     // held_len is 0 if none
+    int uring_wait;             // socket was full, poll before splice
+
+    uint64_t req_start;         // microseconds, request parsed
+    int route;                  // ROUTE_*
+    int status;                 // of the response, for the access log
+    unsigned sent;              // bytes of the response written
+    unsigned timer_sent;        // sent when the write deadline was set
+    access_record access;       // time_us 0 if not sampled
+    dict_db *db;                // response point into, held till done
+
+    http_request req;           // parser state, pipelined requests
 } dict_epoll_data;
 
+// what every connection costs, idle or not: epoll data is this.
+// sizeof = 48
+typedef struct dict_conn {
+    timer_node timer;           // first, so node is the connection
+    int timer_kind;             // TIMER_*, 0 after a response is done
+    int sock_fd;                // -1 once closed, io_uring ops still out
+    unsigned short uring_ops;   // io_uring requests in flight
+    unsigned short uring_recv;  // a recv is one of them, or URING_PARKED
+    uint32_t client;            // IPv4, only with the access log
+    dict_epoll_data *state;     // NULL while idle
+} dict_conn;
+
 int open_nonb_listenfd(int port);
-int nonb_write_headers(int fd, char* bufp, int nleft, dict_epoll_data *ptr);
-int nonb_write_body(int fd, char* bufp, int nleft, dict_epoll_data *ptr);
+int nonb_writev(dict_epoll_data *ptr);
 int nonb_sendfile(dict_epoll_data *ptr);
+void send_response(dict_epoll_data *ptr);
 void accept_incoming(int listen_sock, int epollfd);
-void close_and_clean(dict_epoll_data *ptr, int epollfd);
+void close_and_clean(dict_conn *conn, int epollfd);
+char* conn_header(dict_epoll_data *ptr);
+void send_not_modified(dict_epoll_data *ptr, char *etag, int etag_len, int vary);
+void reply_error(dict_epoll_data *ptr, int status, char *msg);
 void enter_loop(int listen_sock, int epollfd);
-void process_request(dict_epoll_data *ptr, int epollfd);
-void write_response(dict_epoll_data *ptr, int epollfd);
+int process_request(dict_epoll_data *ptr, int epollfd);
+int write_response(dict_epoll_data *ptr, int epollfd);
 
 #endif /* _EPOLL_H_ */
@@ -16,29 +16,39 @@ void client_error(int fd, int status, char *msg, char *longmsg) {
     char buf[MAXLINE];
     sprintf(buf, "HTTP/1.1 %d %s\r\n", status, msg);
     sprintf(buf + strlen(buf),
-            "Content-length: %lu\r\n\r\n", strlen(longmsg));
+            "Content-length: %lu\r\nConnection: close\r\n\r\n",
+            strlen(longmsg));
     if (longmsg[0]) {
         sprintf(buf + strlen(buf), "%s", longmsg);
     }
     writen(fd, buf, strlen(buf));
 }
 
-void url_decode(char* src, char* dest, int max) {
-    char *p = src;
-    char code[3] = { 0 };
-    while(*p && --max) {
-        if(*p == '%') {
-            memcpy(code, ++p, 2);
-            *dest++ = (char)strtoul(code, NULL, 16);
-            p += 2;
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// decode in place, return the new length. src[length] become \0
+int url_decode(char* src, int length) {
+    char *p = src, *end = src + length, *dest = src;
+    while(p < end) {
+        int hi, low;
+        if(*p == '%' && end - p > 2 &&
+           (hi = hex_value(p[1])) >= 0 && (low = hex_value(p[2])) >= 0) {
+            *dest++ = (char)((hi << 4) + low);
+            p += 3;
         } else {
             *dest++ = *p++;
         }
     }
     *dest = '\0';
+    return dest - src;
 }
 
-int open_nonb_listenfd(int port) {
+static int open_listenfd(int port, int reuseport) {
     int listenfd, optval=1;
     struct sockaddr_in serveraddr;
     // Create a socket descriptor
@@ -52,6 +62,14 @@ int open_nonb_listenfd(int port) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
+#ifdef SO_REUSEPORT
+    // every worker bind its own socket, kernel spread connections
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                                (const void *)&optval , sizeof(int)) < 0) {
+        perror("setsockopt: SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
+#endif
     // 6 is TCP's protocol number, don't send out partial frames
     // enable this, much faster : 4000 req/s -> 17000 req/s
     // if (setsockopt(listenfd, 6, TCP_CORK,
@@ -75,6 +93,27 @@ int open_nonb_listenfd(int port) {
     return listenfd;
 }
 
+int open_nonb_listenfd(int port) {
+    return open_listenfd(port, 0);
+}
+
+int open_reuseport_listenfd(int port) {
+    return open_listenfd(port, 1);
+}
+
+int reuseport_supported() {
+    int ok = 0;
+#ifdef SO_REUSEPORT
+    int optval = 1, fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0) {
+        ok = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+                        (const void *)&optval , sizeof(int)) == 0;
+        close(fd);
+    }
+#endif
+    return ok;
+}
+
 #ifdef TEST_SOCKET
 int main(int argc, char** argv) {
     return 0;
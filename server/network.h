@@ -12,14 +12,16 @@
 #include <string.h>
 #include <netinet/tcp.h>        // TCP option
 
-#define LISTENQ  128            // second argument to listen()
+#define LISTENQ  1024           // second argument to listen(), capped by somaxconn
 
 // Simplifies calls to bind(), connect(), and accept()
 typedef struct sockaddr SA;
 
 void make_socket_non_blokcing(int sfd);
 int open_nonb_listenfd(int port);
-void url_decode(char* src, char* dest, int max);
+int open_reuseport_listenfd(int port);
+int reuseport_supported();
+int url_decode(char* src, int length);
 void client_error(int fd, int status, char *msg, char *longmsg);
 
 #endif /* _NETWORK_H_ */
@@ -0,0 +1,99 @@
+#include "resident.h"
+
+static int mode = RESIDENT_POPULATE;
+static const char *mode_names[] = { "lazy", "populate", "lock" };
+
+void resident_init(int m) {
+    mode = m;
+}
+
+// -1 if not a mode
+int resident_mode_of(char *name) {
+    for (int m = RESIDENT_LAZY; m <= RESIDENT_LOCK; m++) {
+        if (strcmp(name, mode_names[m]) == 0) {
+            return m;
+        }
+    }
+    return -1;
+}
+
+const char* resident_mode_name() {
+    return mode_names[mode];
+}
+
+// map dbdata read only. Unless lazy, it is read in big requests and
+// mapped now, by the thread loading it, so no lookup take a major
+// fault later; lock keep it so. locked is set if mlock did
+char* resident_map(int fd, size_t size, int *locked) {
+    int flags = MAP_SHARED;
+    *locked = 0;
+    if (mode != RESIDENT_LAZY) {
+        readahead(fd, 0, size); // page cache first, then page table
+        flags |= MAP_POPULATE;
+    }
+    char *p = mmap(NULL, size, PROT_READ, flags, fd, 0);
+    if (p == MAP_FAILED || mode == RESIDENT_LAZY) {
+        return p;
+    }
+    // all is here: a page evicted later is read alone, lookups jump
+    madvise(p, size, MADV_RANDOM);
+    if (mode == RESIDENT_LOCK) {
+        if (mlock(p, size)) {
+            perror("mlock dbdata, ulimit -l");
+        } else {
+            *locked = 1;
+        }
+    }
+    return p;
+}
+
+// for an index or table made of dbdata: 64 byte aligned. From 2MB up,
+// aligned to and rounded up to huge pages, and asked for them before
+// first touch: fewer TLB misses on random lookups. free() it
+void* resident_alloc(size_t size) {
+    void *p;
+    if (size < HUGE_PAGE) {
+        return posix_memalign(&p, 64, size) ? NULL : p;
+    }
+    size = (size + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+    if (posix_memalign(&p, HUGE_PAGE, size)) {
+        return NULL;
+    }
+    madvise(p, size, MADV_HUGEPAGE); // THP may be off, fine
+    return p;
+}
+
+// bytes of the mapping p in page cache, p is page aligned
+size_t resident_bytes(char *p, size_t size) {
+    unsigned char vec[MINCORE_CHUNK];
+    size_t page = sysconf(_SC_PAGESIZE), total = 0;
+    size_t pages = (size + page - 1) / page;
+    for (size_t i = 0; i < pages; i += MINCORE_CHUNK) {
+        size_t n = pages - i < MINCORE_CHUNK ? pages - i : MINCORE_CHUNK;
+        if (mincore(p + i * page, n * page, vec)) {
+            return 0;
+        }
+        for (size_t k = 0; k < n; k++) {
+            total += vec[k] & 1;
+        }
+    }
+    total *= page;
+    return total < size ? total : size;
+}
+
+// AnonHugePages of the process, bytes. -1 if unknown
+long resident_huge_bytes() {
+    char line[128];
+    long kb = -1;
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+}
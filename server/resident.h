@@ -0,0 +1,34 @@
+#ifndef _RESIDENT_H_
+#define _RESIDENT_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// how dbdata is kept in memory, -m
+#define RESIDENT_LAZY 0         // pages are read by the lookup that fault
+#define RESIDENT_POPULATE 1     // all read and mapped when it is loaded
+#define RESIDENT_LOCK 2         // and mlocked, never evicted
+
+#define HUGE_PAGE (2 << 20)     // x86-64 transparent huge page
+#define MINCORE_CHUNK 4096      // pages asked at a time
+
+void resident_init(int mode);
+
+int resident_mode_of(char *name);
+
+const char* resident_mode_name();
+
+char* resident_map(int fd, size_t size, int *locked);
+
+void* resident_alloc(size_t size);
+
+size_t resident_bytes(char *p, size_t size);
+
+long resident_huge_bytes();
+
+#endif /* _RESIDENT_H_ */
@@ -0,0 +1,249 @@
+#include "response.h"
+#include "dictdb.h"
+#include "log.h"
+
+#define GZIP_MAGIC 0x8b1f
+static char gzip_header[] = {
+    (char) GZIP_MAGIC,          // Magic number (short)
+    (char) (GZIP_MAGIC >> 8),   // Magic number (short)
+    8,                    // Compression method (CM) Deflater.DEFLATED
+    0,                    // Flags (FLG)
+    0,                    // Modification time MTIME (int)
+    0,                    // Modification time MTIME (int)
+    0,                    // Modification time MTIME (int)
+    0,                    // Modification time MTIME (int)
+    0,                    // Extra flags (XFLG)
+    0                     // Operating system (OS)
+};
+
+static char *variant_headers = "Content-Length: %d\r\nCache-Control: max-age=86400, public\r\n%sContent-Type: application/json\r\nVary: Accept-Encoding\r\nETag: \"%016llx\"\r\n\r\n";
+
+static char *content_encodings[ENC_COUNT] = {
+    "",
+    "Content-Encoding: gzip\r\n",
+    "Content-Encoding: br\r\n",
+    "Content-Encoding: zstd\r\n",
+};
+
+static __thread z_stream inflater; // raw deflate, reset for each entry
+static __thread int inflater_ready;
+
+// iovecs of a body being made, bytes of its own are put in [p, end)
+typedef struct {
+    struct iovec *iov;
+    int cnt, max;
+    char *p, *end;
+    int length;
+} body_writer;
+
+// format headers of one variant into buf, return length. ETag is
+// of the bytes, same bytes same ETag across dbdata rebuilds
+static int format_headers(int encoding, entry_variant *v, char *buf,
+                          uint64_t etag) {
+    int length;
+    if (encoding == ENC_GZIP) { // stored without gzip header
+        length = sprintf(buf, variant_headers, v->size + (int)sizeof(gzip_header),
+                         content_encodings[encoding], (unsigned long long)etag);
+        memcpy(buf + length, gzip_header, sizeof(gzip_header));
+        length += sizeof(gzip_header);
+    } else {
+        length = sprintf(buf, variant_headers, v->size,
+                         content_encodings[encoding], (unsigned long long)etag);
+    }
+    return length;
+}
+
+// formatted once here, a hit is just pointers. Into db of the calling
+// thread. -1 if out of memory
+int init_responses() {
+    char buf[256];
+    dict_entry e;
+    int total = word_total();
+    size_t length = 0;
+    word_response *responses = resident_alloc(sizeof(word_response) * total);
+    if (!responses) {
+        perror("resident_alloc");
+        return -1;
+    }
+    memset(responses, 0, sizeof(word_response) * total);
+    for (int i = 0; i < total; i++) { // first pass: how many bytes
+        get_entry(i, &e);
+        for (int enc = 0; enc < ENC_COUNT; enc++) {
+            if (e.variants[enc].data) {
+                length += format_headers(enc, e.variants + enc, buf, 0);
+            }
+        }
+    }
+    char *p = malloc(length + 1); // sprintf add \0
+    db->response.responses = responses;
+    db->response.headers_data = p;
+    if (!p) {
+        perror("malloc");
+        return -1;
+    }
+    for (int i = 0; i < total; i++) {
+        get_entry(i, &e);
+        for (int enc = 0; enc < ENC_COUNT; enc++) {
+            word_variant *v = responses[i].variants + enc;
+            if (e.variants[enc].data) {
+                uint64_t etag = hash_bytes(e.variants[enc].data,
+                                           e.variants[enc].size);
+                v->headers = p;
+                v->headers_cnt = format_headers(enc, e.variants + enc, p, etag);
+                v->etag = strstr(p, "ETag: ") + 6;
+                v->body = e.variants[enc].data;
+                v->body_cnt = e.variants[enc].size;
+                v->encoding = enc;
+                p += v->headers_cnt;
+            }
+        }
+    }
+    LOG(LOG_DEBUG, "%ld responses, %ld bytes of headers", total, length);
+    return 0;
+}
+
+void free_responses(response_data *r) {
+    free(r->responses);
+    free(r->headers_data);
+}
+
+// smallest variant the client accept, bit 1 << ENC_* of accept. NULL
+// if there is none, as a gzip only v1 entry for a client without gzip
+word_variant* get_response(int index, int accept) {
+    word_variant *best = NULL, *v = db->response.responses[index].variants;
+    for (int enc = 0; enc < ENC_COUNT; enc++, v++) {
+        if (v->body && (accept & (1 << enc)) &&
+            (!best || v->body_cnt < best->body_cnt)) {
+            best = v;
+        }
+    }
+    return best;
+}
+
+// n bytes are just put at w->p, join last iovec if it ends there
+static int put_own(body_writer *w, int n) {
+    struct iovec *last = w->cnt ? w->iov + w->cnt - 1 : NULL;
+    if (last && (char*)last->iov_base + last->iov_len == w->p) {
+        last->iov_len += n;
+    } else if (w->cnt < w->max) {
+        w->iov[w->cnt].iov_base = w->p;
+        w->iov[w->cnt++].iov_len = n;
+    } else {
+        return -1;
+    }
+    w->p += n;
+    w->length += n;
+    return 0;
+}
+
+static int put_bytes(body_writer *w, char *s, int n) {
+    if (w->end - w->p < n) {
+        return -1;
+    }
+    memcpy(w->p, s, n);
+    return put_own(w, n);
+}
+
+// in place, no copy
+static int put_ref(body_writer *w, char *s, int n) {
+    if (w->cnt == w->max) {
+        return -1;
+    }
+    w->iov[w->cnt].iov_base = s;
+    w->iov[w->cnt++].iov_len = n;
+    w->length += n;
+    return 0;
+}
+
+// json of the entry into buf, from its gzip variant: data is raw
+// deflate, then crc32 and size. Return length, -1 if buf is too small,
+// -2 if there is no gzip variant or it is broken
+int inflate_entry(int index, char *buf, int size) {
+    dict_entry e;
+    uint32_t length;
+    get_entry(index, &e);
+    entry_variant *v = e.variants + ENC_GZIP;
+    if (!v->data || v->size < 8) {
+        return -2;
+    }
+    memcpy(&length, v->data + v->size - 4, 4); // little-endian
+    if (length > size) {
+        return -1;
+    }
+    if (!inflater_ready) {      // first of this thread
+        if (inflateInit2(&inflater, -MAX_WBITS) != Z_OK) {
+            fprintf(stderr, "inflateInit2 failed\n");
+            exit(1);
+        }
+        inflater_ready = 1;
+    }
+    inflateReset(&inflater);
+    inflater.next_in = (Bytef*)v->data;
+    inflater.avail_in = v->size;
+    inflater.next_out = (Bytef*)buf;
+    inflater.avail_out = length;
+    if (inflate(&inflater, Z_FINISH) != Z_STREAM_END) {
+        return -2;
+    }
+    return inflater.total_out;
+}
+
+// [entry, ...] of the words, null for index -1. Identity variants are
+// sent in place, else gzip ones are inflated into buf: gzip members can
+// not be joined into one. iov describe the body. Return its length, or
+// -1 if buf or iov is too small
+int batch_body(int *indexes, int count, char *buf, int size,
+               struct iovec *iov, int max_iov, int *iov_cnt) {
+    body_writer w = { iov, 0, max_iov, buf, buf + size, 0 };
+    dict_entry e;
+    if (put_bytes(&w, "[", 1)) { return -1; }
+    for (int i = 0; i < count; i++) {
+        int r, length;
+        if (i && put_bytes(&w, ",", 1)) { return -1; }
+        if (indexes[i] < 0) {
+            r = put_bytes(&w, "null", 4);
+        } else {
+            get_entry(indexes[i], &e);
+            entry_variant *v = e.variants + ENC_IDENTITY;
+            if (v->data) {
+                r = put_ref(&w, v->data, v->size);
+            } else if ((length = inflate_entry(indexes[i], w.p, w.end - w.p)) >= 0) {
+                r = put_own(&w, length);
+            } else {            // too big, or broken
+                r = length == -1 ? -1 : put_bytes(&w, "null", 4);
+            }
+        }
+        if (r) { return -1; }
+    }
+    if (put_bytes(&w, "]", 1)) { return -1; }
+    *iov_cnt = w.cnt;
+    return w.length;
+}
+
+// ["word", ...] into buf, words that do not fit are left out.
+// Return length
+int json_word_list(int *indexes, int count, char *buf, int size) {
+    char *p = buf, *end = buf + size - 2; // room for ]
+    *p++ = '[';
+    for (int i = 0; i < count; i++) {
+        char *q = p, *word = word_at(indexes[i]);
+        if (i) { *q++ = ','; }
+        *q++ = '"';
+        for (; *word && q < end - 7; word++) { // 7: \u00XX and "
+            unsigned char c = *word;
+            if (c == '"' || c == '\\') {
+                *q++ = '\\';
+                *q++ = c;
+            } else if (c < 0x20) {
+                q += sprintf(q, "\\u%04x", c);
+            } else {
+                *q++ = c;
+            }
+        }
+        if (*word) { break; }   // no room for this one
+        *q++ = '"';
+        p = q;
+    }
+    *p++ = ']';
+    return p - buf;
+}
@@ -0,0 +1,47 @@
+#ifndef _RESPONSE_H_
+#define _RESPONSE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#include "hash.h"
+#include "search.h"
+
+#define STATUS_200 "HTTP/1.1 200 OK\r\n"
+
+// everything of a /d/:word response, but status line and Connection
+typedef struct {
+    char *headers;              // headers, blank line, gzip header
+    int headers_cnt;
+    char *body;                 // in mmapped dbdata, NULL if no variant
+    int body_cnt;
+    int encoding;               // ENC_*
+    char *etag;                 // quoted, ETAG_LEN, in headers
+} word_variant;
+
+typedef struct {
+    word_variant variants[ENC_COUNT]; // by ENC_*
+} word_response;
+
+// of a dict_db: by word index, headers all in one block
+typedef struct {
+    word_response *responses;
+    char *headers_data;
+} response_data;
+
+int init_responses();
+
+void free_responses(response_data *r);
+
+word_variant* get_response(int index, int accept);
+
+int inflate_entry(int index, char *buf, int size);
+
+int batch_body(int *indexes, int count, char *buf, int size,
+               struct iovec *iov, int max_iov, int *iov_cnt);
+
+int json_word_list(int *indexes, int count, char *buf, int size);
+
+#endif /* _RESPONSE_H_ */
@@ -1,8 +1,7 @@
 #include "search.h"
-
-static int word_count;
-static int* index_data;
-static char* dict_data;
+#include "hash.h"
+#include "eytzinger.h"
+#include "dictdb.h"
 
 static off_t get_file_size (int fd) {
     struct stat statbuf;
@@ -22,61 +21,273 @@ int read_short(char *buf, int offset) {
     return (hi << 8) + low;
 }
 
-// TODO elvis
-static int* build_index(int total_length) {
-    int* index_data = (int*)malloc(sizeof(int) * word_count);
+// v1 file has no index, walk it. NULL if a word or its data is out of
+// the file, or there are less words than it say: a half written one
+static uint32_t* build_index(search_data *s) {
+    uint32_t* index_data = resident_alloc(sizeof(uint32_t) * s->word_count);
+    if (!index_data) {
+        perror("resident_alloc");
+        return NULL;
+    }
     int word_index = 0, next_count, index = 2; // ignore first 2 byte, that's word count
-    while(index < total_length) {
+    char *end;
+    while(index < s->size && word_index < s->word_count) {
+        // word is terminated by \0, then 2 byte size
+        if (!(end = memchr(s->data + index, '\0', s->size - index)) ||
+            end - s->data + 3 > s->size) {
+            break;
+        }
         index_data[word_index++] = index;
-        while(dict_data[index++]);   // skip word, word is terminated by \0
-        next_count = read_short(dict_data, index);
+        index = end - s->data + 1;
+        next_count = read_short(s->data, index);
         if (next_count > 0xe000) { // first bit: is gzipped
             next_count -= 0xe000;
         }
         index += next_count + 2;
     }
+    if (word_index < s->word_count || index > s->size) {
+        free(index_data);
+        return NULL;
+    }
     return index_data;
 }
 
-// return index in data, or -1 if not found, target is all lowercase
-char* search_word(char* target) {
-    int low = 0, high = word_count - 1;
+static int bsearch_index(char* target) {
+    search_data *s = &db->search;
+    int low = 0, high = s->word_count - 1;
     while(low <= high) {
         int mid = (low + high) >> 1;
-        int cmp = strcmp(target, dict_data + index_data[mid]);
+        int cmp = strcmp(target, s->data + s->index_data[mid]);
         // printf("%s, %s, %d, mid %d\n", target, data + index_data[mid], cmp, mid);
         if(cmp > 0) {
             low = mid + 1;
         } else if (cmp < 0) {
             high = mid - 1;
         } else {
-            int offset = index_data[mid] + strlen(target) + 1;
-#ifdef DEBUG
-            printf("find \'%s\', offset is %d\n", target, offset);
-#endif
-            return dict_data + offset;
+            return mid;
         }
     }
-#ifdef DEBUG
-    printf("not find %s\n", target);
-#endif
-    return 0;                   // not found
+    return -1;                  // not found
+}
+
+// return index of the word, or -1 if not found, target is all lowercase
+int search_index(char* target) {
+    search_data *s = &db->search;
+    int index;
+    if (s->index_type == INDEX_HASH) {
+        index = hash_lookup(&s->hash, target);
+    } else if (s->index_type == INDEX_EYTZINGER) {
+        index = eytzinger_lower_bound(&s->eytzinger, target);
+        if (index == s->word_count ||
+            strcmp(target, s->data + s->index_data[index])) {
+            index = -1;
+        }
+    } else {
+        index = bsearch_index(target);
+    }
+    return index;
+}
+
+// search_index for many words, index or -1 of each is put in result.
+// Lookups of different words overlap
+void search_batch(char **targets, int count, int *result) {
+    search_data *s = &db->search;
+    if (s->index_type == INDEX_HASH) {
+        hash_lookup_batch(&s->hash, targets, count, result);
+    } else if (s->index_type == INDEX_EYTZINGER) {
+        eytzinger_lower_bound_batch(&s->eytzinger, targets, count, result);
+        for (int i = 0; i < count; i++) {
+            if (result[i] == s->word_count ||
+                strcmp(targets[i], s->data + s->index_data[result[i]])) {
+                result[i] = -1;
+            }
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            result[i] = bsearch_index(targets[i]);
+        }
+    }
+}
+
+// index of first word >= target, word count if none. For range query
+int search_lower_bound(char* target) {
+    return eytzinger_lower_bound(&db->search.eytzinger, target);
+}
+
+// return where the word's size and data are, or 0 if not found
+char* search_word(char* target) {
+    int index = search_index(target);
+    if (index < 0) {
+        return 0;
+    }
+    return word_at(index) + strlen(target) + 1;
+}
+
+int word_total() {
+    return db->search.word_count;
+}
+
+char* word_at(int index) {
+    return db->search.data + db->search.index_data[index];
+}
+
+int data_fd() {
+    return db->search.fd;
+}
+
+// p point into dbdata, where it is in the file
+off_t data_offset(char *p) {
+    return p - db->search.data;
+}
+
+void get_entry(int index, dict_entry *entry) {
+    char *word = word_at(index);
+    char *loc = word + strlen(word) + 1;
+    entry_variant *v;
+    uint32_t size;
+    entry->word = word;
+    memset(entry->variants, 0, sizeof(entry->variants));
+    if (db->search.version == 3) { // count, then encoding, size, data of each
+        int count = (unsigned char)*loc++;
+        for (int i = 0; i < count; i++) {
+            int encoding = (unsigned char)loc[0];
+            memcpy(&size, loc + 1, 4); // little-endian
+            if (encoding < ENC_COUNT) {
+                v = entry->variants + encoding;
+                v->data = loc + 5;
+                v->size = size;
+            }
+            loc += 5 + size;
+        }
+    } else if (db->search.version == 2) {
+        memcpy(&size, loc + 1, 4);
+        v = entry->variants + (loc[0] & DB_GZIPPED ? ENC_GZIP : ENC_IDENTITY);
+        v->data = loc + 5;      // 1 byte flags, 4 byte for size
+        v->size = size;
+    } else {
+        size = read_short(loc, 0);
+        if (size < 0xe000) {    // first bit: is not gzipped
+            v = entry->variants + ENC_GZIP;
+            v->size = size;
+        } else {
+            v = entry->variants + ENC_IDENTITY;
+            v->size = size - 0xe000;
+        }
+        v->data = loc + 2;      // 2 byte for size
+    }
 }
 
-void init_dict_search() {
-    int fd = open(FILENAME, O_RDONLY);
-    if(fd <= 0) { perror(FILENAME); exit(1); }
-    off_t length = get_file_size(fd);
-    dict_data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
-    close(fd);
-    word_count = read_short(dict_data, 0);
-    index_data = build_index(length);
+// words and their variants must be before the index, the index in
+// the file: it may be a half written one. v2 is v3 with one variant,
+// without the count
+static int check_entries(search_data *s, uint32_t index_offset) {
+    char *end = s->data + index_offset;
+    if (index_offset < sizeof(db_header) || index_offset > s->size ||
+        (s->size - index_offset) / 4 < (uint32_t)s->word_count) {
+        return -1;
+    }
+    for (int i = 0; i < s->word_count; i++) {
+        uint32_t off = s->index_data[i], size;
+        char *p = s->data + off;
+        if (off < sizeof(db_header) || off >= index_offset ||
+            !(p = memchr(p, '\0', end - p)) || ++p == end) {
+            return -1;
+        }
+        int count = s->version == 3 ? (unsigned char)*p++ : 1;
+        for (int k = 0; k < count; k++) {
+            if (end - p < 5) {
+                return -1;
+            }
+            memcpy(&size, p + 1, 4);
+            if (size > (uint32_t)(end - p - 5)) {
+                return -1;
+            }
+            p += 5 + size;
+        }
+    }
+    return 0;
+}
+
+// map FILENAME and index it into db->search of the calling thread.
+// -1 and a message if the file is missing or broken
+int init_dict_search(int type) {
+    search_data *s = &db->search;
+    memset(s, 0, sizeof(search_data));
+    int fd = open(FILENAME, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { perror(FILENAME); return -1; }
+    s->fd = fd;
+    s->size = get_file_size(fd);
+    s->data = resident_map(fd, s->size, &s->locked);
+    if (s->size < 2 || s->data == MAP_FAILED) {
+        fprintf(stderr, "%s: can not map\n", FILENAME);
+        s->data = NULL;
+        free_dict_search(s);
+        return -1;
+    }
+    db_header *header = (db_header*)s->data;
+    if (s->size >= sizeof(db_header) &&
+        memcmp(header->magic, DB_MAGIC, sizeof(header->magic)) == 0) {
+        if (header->version < 2 || header->version > DB_VERSION) {
+            fprintf(stderr, "%s: unknown version %d\n", FILENAME,
+                    header->version);
+            free_dict_search(s);
+            return -1;
+        }
+        s->version = header->version; // index is in file, nothing to parse
+        s->word_count = header->word_count;
+        s->index_data = (uint32_t*)(s->data + header->index_offset);
+        if (check_entries(s, header->index_offset)) {
+            fprintf(stderr, "%s: truncated or broken\n", FILENAME);
+            free_dict_search(s);
+            return -1;
+        }
+    } else {
+        s->version = 1;
+        s->word_count = read_short(s->data, 0);
+        if (!(s->index_data = s->built = build_index(s))) {
+            fprintf(stderr, "%s: truncated or broken\n", FILENAME);
+            free_dict_search(s);
+            return -1;
+        }
+    }
+    s->index_type = type;
+    if (eytzinger_build(&s->eytzinger, s->data, s->index_data, s->word_count) ||
+        (type == INDEX_HASH &&
+         hash_build(&s->hash, s->data, s->index_data, s->word_count))) {
+        free_dict_search(s);
+        return -1;
+    }
+    return 0;
+}
+
+void free_dict_search(search_data *s) {
+    free(s->hash.slots);
+    free(s->eytzinger.nodes);
+    free(s->built);
+    if (s->data) {
+        munmap(s->data, s->size);
+    }
+    if (s->fd > 0) {            // 0 if never opened
+        close(s->fd);
+    }
+    memset(s, 0, sizeof(search_data));
 }
 
 #ifdef TEST_SEARCH
 
+// words before index are less than target, the rest are not
+static int is_lower_bound(char* target, int index) {
+    return (index == 0 || strcmp(word_at(index - 1), target) < 0)
+        && (index == word_total() || strcmp(word_at(index), target) >= 0);
+}
+
+__thread dict_db *db;
+
 int main(int argc, char** argv) {
-    init_dict_search();
+    static dict_db test_db;
+    db = &test_db;
+    if (init_dict_search(INDEX_HASH)) { exit(1); }
+    search_data *s = &db->search;
     char * targets[] = {
         "yuppify", "bird-watcher", "arthritis", "ali, muhammad", "-monger",
         "yukon", "women's studies", "not exits", "go", "zoo"
@@ -85,5 +296,51 @@ int main(int argc, char** argv) {
         char* result = search_word(targets[i]);
         printf("%s, %p\n",targets[i], result);
     }
+    // hash and eytzinger must agree with binary search, for every word
+    // and some misses
+    char miss[256];
+    int errors = 0;
+    for (int i = 0; i < s->word_count; ++i) {
+        char *word = word_at(i);
+        if (hash_lookup(&s->hash, word) != i || bsearch_index(word) != i ||
+            search_lower_bound(word) != i) {
+            printf("mismatch: %s, %d\n", word, i);
+            errors++;
+        }
+        snprintf(miss, sizeof(miss), "%s~", word);
+        if (hash_lookup(&s->hash, miss) != bsearch_index(miss) ||
+            !is_lower_bound(miss, search_lower_bound(miss))) {
+            printf("mismatch: %s\n", miss);
+            errors++;
+        }
+        snprintf(miss, sizeof(miss), "%s", word);
+        miss[strlen(miss) - 1]--; // a bit less than word
+        if (!is_lower_bound(miss, search_lower_bound(miss))) {
+            printf("mismatch: %s\n", miss);
+            errors++;
+        }
+    }
+    // batch lookup must agree with one by one, hits and misses mixed
+    char *batch[100], misses[50][256];
+    int batch_result[100];
+    for (int i = 0; i + 50 <= s->word_count; i += 50) {
+        for (int j = 0; j < 50; j++) {
+            batch[2 * j] = word_at(i + j);
+            snprintf(misses[j], sizeof(misses[j]), "%s~", batch[2 * j]);
+            batch[2 * j + 1] = misses[j];
+        }
+        for (int type = INDEX_BSEARCH; type <= INDEX_EYTZINGER; type++) {
+            s->index_type = type;
+            search_batch(batch, 100, batch_result);
+            for (int j = 0; j < 100; j++) {
+                if (batch_result[j] != bsearch_index(batch[j])) {
+                    printf("batch mismatch: %s, type %d\n", batch[j], type);
+                    errors++;
+                }
+            }
+        }
+    }
+    printf("%d words checked, %d errors\n", s->word_count, errors);
+    return errors != 0;
 }
 #endif
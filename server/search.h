@@ -2,6 +2,7 @@
 #define _SEARCH_H_
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,15 +10,84 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "eytzinger.h"
+#include "hash.h"
+#include "resident.h"
 
 #define FILENAME "../server/dbdata"
 
 // #define TEST_SEARCH
 
+#define DB_MAGIC "DICTDB"
+#define DB_VERSION 3            // newest, v2 is still read
+#define DB_GZIPPED 1            // v2 entry flag
+
+// content coding of an entry's variant, v3 stores some of them
+#define ENC_IDENTITY 0          // json
+#define ENC_GZIP 1              // raw deflate, crc32, size: gzip but header
+#define ENC_BR 2
+#define ENC_ZSTD 3
+#define ENC_COUNT 4
+
+// v2 and v3 dbdata, little-endian. v1 has no header, see README
+typedef struct {
+    char magic[6];              // DICTDB
+    uint16_t version;
+    uint32_t word_count;
+    uint32_t index_offset;      // uint32_t offsets of words, sorted
+} db_header;
+
+#define INDEX_BSEARCH 0         // binary search on sorted offsets
+#define INDEX_HASH 1            // open addressing hash, exact match only
+#define INDEX_EYTZINGER 2       // BFS ordered, key prefix inline
+
+// a mapped dbdata and its indexes, one of a dict_db
+typedef struct {
+    int word_count;
+    uint32_t *index_data;       // offset of words, sorted
+    char *data;
+    off_t size;
+    int fd;                     // kept open, entries can be sendfile from
+    int version;
+    int index_type;
+    int locked;                 // data is mlocked
+    uint32_t *built;            // index_data if made here, v1 only
+    hash_index hash;
+    eytzinger_index eytzinger;  // for ordered lookup
+} search_data;
+
+typedef struct {
+    char *data;                 // NULL if the entry has no such variant
+    int size;
+} entry_variant;
+
+typedef struct {
+    char *word;                 // \0 terminated
+    entry_variant variants[ENC_COUNT]; // by ENC_*
+} dict_entry;
+
 int read_short(char *buf, int offset);
 
 char* search_word(char* target);
 
-void init_dict_search();
+int search_index(char* target);
+
+void search_batch(char **targets, int count, int *result);
+
+int search_lower_bound(char* target);
+
+int word_total();
+
+char* word_at(int index);
+
+int data_fd();
+
+off_t data_offset(char *p);
+
+void get_entry(int index, dict_entry *entry);
+
+int init_dict_search(int type);
+
+void free_dict_search(search_data *s);
 
 #endif /* _SEARCH_H_ */
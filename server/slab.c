@@ -0,0 +1,43 @@
+#include "slab.h"
+
+void slab_init(slab *s, size_t obj_size, int capacity) {
+    // keep objects 16 byte aligned, big enough to hold the link
+    obj_size = (obj_size + 15) & ~(size_t)15;
+    s->obj_size = obj_size;
+    s->capacity = capacity;
+    s->in_use = s->peak = 0;
+    s->full = 0;
+    // MAP_POPULATE: prefault now, no page fault when connections come
+    s->mem = mmap(NULL, obj_size * capacity, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (s->mem == MAP_FAILED) {
+        perror("slab mmap");
+        exit(EXIT_FAILURE);
+    }
+    s->free_list = NULL;
+    for (int i = capacity - 1; i >= 0; i--) { // low address first
+        void **obj = (void**)(s->mem + obj_size * i);
+        *obj = s->free_list;
+        s->free_list = obj;
+    }
+}
+
+// NULL if all in use
+void* slab_alloc(slab *s) {
+    void **obj = s->free_list;
+    if (!obj) {
+        s->full++;
+        return NULL;
+    }
+    s->free_list = *obj;
+    if (++s->in_use > s->peak) {
+        s->peak = s->in_use;
+    }
+    return obj;
+}
+
+void slab_free(slab *s, void *obj) {
+    *(void**)obj = s->free_list;
+    s->free_list = obj;
+    s->in_use--;
+}
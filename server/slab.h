@@ -0,0 +1,26 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// fixed size objects, one mmap, free list through the free objects.
+// Per worker, no lock
+typedef struct {
+    size_t obj_size;
+    int capacity;
+    int in_use;
+    int peak;                   // max in_use ever
+    long full;                  // alloc failed because all in use
+    char *mem;
+    void *free_list;
+} slab;
+
+void slab_init(slab *s, size_t obj_size, int capacity);
+
+void* slab_alloc(slab *s);
+
+void slab_free(slab *s, void *obj);
+
+#endif /* _SLAB_H_ */
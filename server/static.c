@@ -2,8 +2,6 @@
 #include "network.h"
 
 static mime_map meme_types [] = {
-    {".html.gz", "text/html"},
-    {".js.gz", "application/js"},
     {".jpg", "image/jpeg"},
     {".jpeg", "image/jpeg"},
     {".css", "text/css"},
@@ -21,62 +19,523 @@ static mime_map meme_types [] = {
 
 static char *default_mime_type = "text/plain";
 
-static char *static_headers = "HTTP/1.1 200 OK\r\nContent-length: %lu\r\nCache-Control: max-age=86400, public\r\nContent-type: %s\r\n\r\n";
-static char *gziped_static_headers = "HTTP/1.1 200 OK\r\nContent-length: %lu\r\nCache-Control: max-age=86400, public\r\nContent-type: %s\r\nContent-Encoding: gzip\r\n\r\n";
+static char *static_headers = "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\nCache-Control: max-age=86400, public\r\nContent-Type: %s\r\n%s%sETag: %s\r\nLast-Modified: %s\r\n";
 
-static const char* get_mime_type(char *filename){
-    char *dot = strchr(filename, '.');
-    if(dot){ // strchr Locate first occurrence of character in string
-        mime_map *map = meme_types;
-        while(map->extension){
-            if(strcmp(map->extension, dot) == 0){
+static char *content_encodings[ENC_COUNT] = {
+    "", "Content-Encoding: gzip\r\n", "Content-Encoding: br\r\n",
+    "Content-Encoding: zstd\r\n",
+};
+
+static char *encoding_suffixes[ENC_COUNT] = { "", ".gz", ".br", ".zst" };
+
+// each worker thread has its own table, files and inotify
+static __thread static_asset **assets; // of current table
+static __thread int asset_count;
+static __thread static_asset **table; // open addressing by path
+static __thread uint32_t table_mask;
+static __thread int watch_fd = -1; // inotify, all scanned directories
+static __thread char **watch_dirs; // path of each watch, by wd
+static __thread int watch_cap;
+static __thread long reload_count;
+
+static uint32_t hash_path(const char *path) {
+    uint32_t h = 2166136261u;
+    while (*path) {
+        h ^= (unsigned char)*path++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static static_asset* find_in(static_asset **t, uint32_t mask, const char *path) {
+    uint32_t slot = hash_path(path) & mask;
+    static_asset *a;
+    while ((a = t[slot])) {
+        if (strcmp(a->path, path) == 0) {
+            return a;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+// in the current table, none before the first
+static static_asset* find_asset(const char *path) {
+    return table ? find_in(table, table_mask, path) : NULL;
+}
+
+// a into its slot of t, in place of one with the same path
+static void place(static_asset **t, uint32_t mask, static_asset *a) {
+    uint32_t slot = hash_path(a->path) & mask;
+    while (t[slot] && strcmp(t[slot]->path, a->path)) {
+        slot = (slot + 1) & mask;
+    }
+    t[slot] = a;
+}
+
+// encoding of a .gz, .br or .zst file, ENC_IDENTITY if none
+static int path_encoding(const char *path, int length) {
+    for (int enc = ENC_GZIP; enc < ENC_COUNT; enc++) {
+        int n = strlen(encoding_suffixes[enc]);
+        if (length > n && strcmp(path + length - n, encoding_suffixes[enc]) == 0) {
+            return enc;
+        }
+    }
+    return ENC_IDENTITY;
+}
+
+// by last extension, of the name without .gz .br .zst
+static const char* get_mime_type(char *path, int length) {
+    char name[MAXLINE];
+    int enc = path_encoding(path, length);
+    length -= strlen(encoding_suffixes[enc]);
+    if (length >= MAXLINE) {
+        return default_mime_type;
+    }
+    memcpy(name, path, length);
+    name[length] = '\0';
+    char *dot = strrchr(name, '.');
+    if (dot) {
+        for (mime_map *map = meme_types; map->extension; map++) {
+            if (strcasecmp(map->extension, dot) == 0) {
                 return map->mime_type;
             }
-            map++;
         }
     }
     return default_mime_type;
 }
 
-static void serve_static(dict_epoll_data *ptr, char* uri, size_t total_size) {
-    char *bufp = ptr->headers;
-    int uri_length = strlen(uri);
-    if (uri[uri_length - 2] == 'g' && uri[uri_length - 1] == 'z') {
-        sprintf(bufp, gziped_static_headers, total_size, get_mime_type(uri));
-    } else {
-        sprintf(bufp, static_headers, total_size, get_mime_type(uri));
+static void free_asset(static_asset *a) {
+    close(a->fd);
+    free(a->path);
+    free(a->headers);
+    free(a);
+}
+
+// open path, read it once for a strong ETag, into list. Not there or
+// not a regular file is left out. -1 if out of memory
+static int add_asset(static_asset **list, int *count, char *path) {
+    struct stat sbuf;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &sbuf) || !S_ISREG(sbuf.st_mode)) {
+        close(fd);
+        return 0;
+    }
+    if (*count == MAX_ASSETS) {
+        fprintf(stderr, "more than %d static files, %s is left out\n",
+                MAX_ASSETS, path);
+        close(fd);
+        return 0;
+    }
+    static_asset *a = calloc(1, sizeof(static_asset));
+    if (!a || !(a->path = strdup(path))) {
+        free(a);
+        close(fd);
+        return -1;
+    }
+    a->fd = fd;
+    a->size = sbuf.st_size;
+    a->mtime = sbuf.st_mtime;
+    a->mime_type = get_mime_type(path, strlen(path));
+    uint64_t h = hash_bytes(NULL, 0);
+    if (a->size) {
+        void *p = mmap(NULL, a->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            h = hash_bytes(p, a->size);
+            munmap(p, a->size);
+        }
+    }
+    sprintf(a->etag, "\"%016llx\"", (unsigned long long)h);
+    list[(*count)++] = a;
+    return 0;
+}
+
+// same file, own fd and no headers yet
+static static_asset* clone_asset(static_asset *a) {
+    static_asset *c = malloc(sizeof(static_asset));
+    if (!c) {
+        return NULL;
     }
-    if (nonb_write_headers(ptr->sock_fd, bufp, strlen(bufp), ptr)) {
-        nonb_sendfile(ptr);
+    *c = *a;
+    c->headers = NULL;
+    c->users = c->stale = 0;
+    c->fd = dup(a->fd);
+    c->path = strdup(a->path);
+    if (c->fd < 0 || !c->path) {
+        free_asset(c);
+        return NULL;
+    }
+    return c;
+}
+
+// events of wd are named relative to dir. Not remembered, an event of
+// it rescans all
+static void watch_dir(int wd, char *dir) {
+    if (wd >= watch_cap) {
+        int cap = wd * 2 + 16;
+        char **dirs = realloc(watch_dirs, sizeof(char*) * cap);
+        if (!dirs) {
+            return;
+        }
+        memset(dirs + watch_cap, 0, sizeof(char*) * (cap - watch_cap));
+        watch_dirs = dirs;
+        watch_cap = cap;
     }
+    free(watch_dirs[wd]);
+    watch_dirs[wd] = strdup(dir);
 }
 
-void serve_file(dict_epoll_data *ptr, char *uri) {
+// every regular file under dir into list, hidden ones are skipped. -1
+// if out of memory
+static int scan_dir(char *dir, int depth, static_asset **list, int *count) {
+    char path[MAXLINE];
+    DIR *d = opendir(dir);
+    struct dirent *entry;
     struct stat sbuf;
-    int conn_sock = ptr->sock_fd;
-    int ffd = open(uri, O_RDONLY);
-#ifdef DEBUG
-    printf("sock_fd: %d, openfile: %s, fd: %d\n", ptr->sock_fd, uri, ffd);
-#endif
-    if(ffd <= 0) {
-        perror(uri);
-        char *msg = "File not found";
-        client_error(conn_sock, 404, "Not found", msg);
-    } else {
-        fstat(ffd, &sbuf);
-        if(S_ISREG(sbuf.st_mode)){
-            ptr->static_fd = ffd;
-            ptr->file_offset = 0;
-            ptr->file_cnt = sbuf.st_size;
-            serve_static(ptr, uri, sbuf.st_size); // will close ffd
-        } else if(S_ISDIR(sbuf.st_mode)){
-            char *msg = "Dir listing is not impleted";
-            client_error(conn_sock, 404, "Error", msg);
-            close(ffd);
+    int ret = 0;
+    if (!d) {
+        perror(dir);
+        return 0;
+    }
+    int wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_CREATE |
+                               IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                               IN_ATTRIB);
+    if (wd >= 0) {
+        watch_dir(wd, dir);
+    }
+    while (!ret && (entry = readdir(d))) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        int n = strcmp(dir, ".") ? snprintf(path, MAXLINE, "%s/%s", dir, entry->d_name)
+            : snprintf(path, MAXLINE, "%s", entry->d_name);
+        if (n >= MAXLINE || stat(path, &sbuf)) {
+            continue;
+        }
+        if (S_ISDIR(sbuf.st_mode)) {
+            if (depth < MAX_DEPTH) {
+                ret = scan_dir(path, depth + 1, list, count);
+            }
+        } else if (S_ISREG(sbuf.st_mode)) {
+            ret = add_asset(list, count, path);
+        }
+    }
+    closedir(d);
+    return ret;
+}
+
+// Vary if path has a variant in t, or is one of a file in t
+static int varies(static_asset **t, uint32_t mask, char *path) {
+    char buf[MAXLINE];
+    int length = strlen(path);
+    int enc = path_encoding(path, length);
+    if (enc != ENC_IDENTITY) {  // only if requested as itself
+        length -= strlen(encoding_suffixes[enc]);
+        memcpy(buf, path, length);
+        buf[length] = '\0';
+        if (find_in(t, mask, buf)) {
+            return 1;
+        }
+    }
+    for (int i = ENC_GZIP; i < ENC_COUNT; i++) {
+        if (snprintf(buf, MAXLINE, "%s%s", path, encoding_suffixes[i]) < MAXLINE
+            && find_in(t, mask, buf)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// headers once. -1 if out of memory
+static int format_headers(static_asset *a, int vary) {
+    char buf[MAXLINE], date[64];
+    struct tm tm;
+    int enc = path_encoding(a->path, strlen(a->path));
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT",
+             gmtime_r(&a->mtime, &tm));
+    a->vary = vary;
+    a->headers_cnt = snprintf(buf, MAXLINE, static_headers,
+                              (unsigned long)a->size, a->mime_type,
+                              content_encodings[enc],
+                              vary ? "Vary: Accept-Encoding\r\n" : "",
+                              a->etag, date);
+    a->headers = strdup(buf);
+    return a->headers ? 0 : -1;
+}
+
+// list is the new assets: some of the current table, kept as they are,
+// the others just loaded. Its table, variants and headers are made, then
+// it is the current one. Ones left out are freed, by static_release if
+// being sent. Headers of a kept one are never changed, a response may
+// point to them: if its Vary change, a clone take its place. -1 if out
+// of memory, the current table stay and list is freed
+static int swap_table(static_asset **list, int count) {
+    char path[MAXLINE];
+    uint32_t size = 1;
+    while (size < (uint32_t)count * 2 + 2) { size <<= 1; }
+    uint32_t mask = size - 1;
+    static_asset **t = calloc(size, sizeof(static_asset*));
+    if (!t) {
+        goto fail;
+    }
+    for (int i = 0; i < count; i++) {
+        place(t, mask, list[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        static_asset *a = list[i];
+        int vary = varies(t, mask, a->path);
+        if (find_asset(a->path) == a) {
+            if (vary == a->vary) {
+                continue;
+            }
+            if (!(a = clone_asset(a))) {
+                goto fail;
+            }
+            list[i] = a;
+            place(t, mask, a);
+        }
+        if (format_headers(a, vary)) {
+            goto fail;
+        }
+    }
+
+    // nothing can fail from here
+    for (int i = 0; i < count; i++) {
+        static_asset *a = list[i];
+        a->variants[ENC_IDENTITY] = a;
+        for (int enc = ENC_GZIP; enc < ENC_COUNT; enc++) {
+            a->variants[enc] = NULL;
+            if (snprintf(path, MAXLINE, "%s%s", a->path,
+                         encoding_suffixes[enc]) < MAXLINE) {
+                a->variants[enc] = find_in(t, mask, path);
+            }
+        }
+    }
+    for (int i = 0; i < asset_count; i++) {
+        static_asset *a = assets[i];
+        if (find_in(t, mask, a->path) == a) {
+            continue;
+        }
+        if (a->users) {
+            a->stale = 1;
         } else {
-            char *msg = "Unknow Error";
-            client_error(conn_sock, 400, "Error", msg);
-            close(ffd);
+            free_asset(a);
+        }
+    }
+    free(assets);
+    free(table);
+    assets = list;
+    asset_count = count;
+    table = t;
+    table_mask = mask;
+    return 0;
+
+fail:
+    for (int i = 0; i < count; i++) {
+        if (find_asset(list[i]->path) != list[i]) {
+            free_asset(list[i]);
+        }
+    }
+    free(list);
+    free(t);
+    return -1;
+}
+
+// scan document root, the current directory, into a new table. -1 if
+// out of memory, the current one stay
+static int build_table() {
+    int count = 0;
+    static_asset **list = malloc(sizeof(static_asset*) * MAX_ASSETS);
+    if (!list) {
+        return -1;
+    }
+    if (scan_dir(".", 0, list, &count)) {
+        for (int i = 0; i < count; i++) {
+            free_asset(list[i]);
+        }
+        free(list);
+        return -1;
+    }
+    return swap_table(list, count);
+}
+
+// only paths changed are read again, the others are kept. -1 if out
+// of memory, the current table stay
+static int update_table(char (*changed)[MAXLINE], int n) {
+    int count = 0;
+    static_asset **list = malloc(sizeof(static_asset*) * MAX_ASSETS);
+    if (!list) {
+        return -1;
+    }
+    for (int i = 0; i < asset_count; i++) {
+        int k = 0;
+        while (k < n && strcmp(changed[k], assets[i]->path)) {
+            k++;
+        }
+        if (k == n) {
+            list[count++] = assets[i];
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        if (add_asset(list, &count, changed[k])) {
+            for (int i = 0; i < count; i++) {
+                if (find_asset(list[i]->path) != list[i]) {
+                    free_asset(list[i]);
+                }
+            }
+            free(list);
+            return -1;
+        }
+    }
+    return swap_table(list, count);
+}
+
+void init_static() {
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) {
+        perror("inotify_init1");
+        exit(EXIT_FAILURE);
+    }
+    if (build_table()) {
+        perror("static files");
+        exit(EXIT_FAILURE);
+    }
+    printf("%d static files\n", asset_count);
+}
+
+int static_watch_fd() {
+    return watch_fd;
+}
+
+// path of a file event into changed, once. 0 if it need a rescan: a
+// directory, a lost event, too many files
+static int add_change(struct inotify_event *e, char (*changed)[MAXLINE], int *n) {
+    if ((e->mask & (IN_ISDIR | IN_Q_OVERFLOW)) || e->wd < 0 ||
+        e->wd >= watch_cap || !watch_dirs[e->wd] || *n == MAX_CHANGES) {
+        return 0;
+    }
+    char *dir = watch_dirs[e->wd], *path = changed[*n];
+    int length = strcmp(dir, ".") ? snprintf(path, MAXLINE, "%s/%s", dir, e->name)
+        : snprintf(path, MAXLINE, "%s", e->name);
+    if (length >= MAXLINE) {
+        return 1;
+    }
+    for (int k = 0; k < *n; k++) {
+        if (strcmp(changed[k], path) == 0) {
+            return 1;
+        }
+    }
+    (*n)++;
+    return 1;
+}
+
+// inotify fd is readable: drain it, then one update for all events.
+// Changed files are read again, a directory change rescan all
+void static_changed() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char changed[MAX_CHANGES][MAXLINE];
+    int n = 0, rescan = 0, events = 0;
+    ssize_t length;
+    while ((length = read(watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + length;
+             p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            struct inotify_event *e = (struct inotify_event*)p;
+            if (e->mask & IN_IGNORED) { // watch is gone with its directory
+                if (e->wd >= 0 && e->wd < watch_cap) {
+                    free(watch_dirs[e->wd]);
+                    watch_dirs[e->wd] = NULL;
+                }
+                continue;
+            }
+            if (e->len && e->name[0] == '.') {
+                continue;
+            }
+            events++;
+            if (!rescan && !(e->len && add_change(e, changed, &n))) {
+                rescan = 1;
+            }
+        }
+    }
+    if (!events) {
+        return;
+    }
+    if (rescan ? build_table() : update_table(changed, n)) {
+        LOG(LOG_ERROR, "no memory for static files, %ld old ones are kept",
+            asset_count);
+        return;
+    }
+    reload_count++;
+    LOG(LOG_INFO, "static files changed, %ld now, %ld read again",
+        asset_count, rescan ? asset_count : n);
+}
+
+int static_asset_count() {
+    return asset_count;
+}
+
+long static_reload_count() {
+    return reload_count;
+}
+
+// response of ptr is done with its asset
+void static_release(dict_epoll_data *ptr) {
+    static_asset *a = ptr->asset;
+    if (a) {
+        ptr->asset = NULL;
+        if (--a->users == 0 && a->stale) {
+            free_asset(a);
         }
     }
 }
+
+// uri is relative to document root. Smallest variant the client take,
+// all from memory, headers then sendfile. Return 0 if there is no such
+// file, 404 is sent
+int serve_file(dict_epoll_data *ptr, char *uri) {
+    char path[MAXLINE];
+    static_asset *a = find_asset(uri);
+    if (!a && snprintf(path, MAXLINE, "%s.gz", uri) < MAXLINE) {
+        a = find_asset(path);   // only gzipped one is there
+    }
+    if (!a) {
+        reply_error(ptr, 404, "Not found");
+        return 0;
+    }
+    static_asset *best = a;
+    for (int enc = ENC_GZIP; enc < ENC_COUNT; enc++) {
+        static_asset *v = a->variants[enc];
+        if (v && (ptr->req.accept_enc & (1 << enc)) && v->size < best->size) {
+            best = v;
+        }
+    }
+    if (http_not_modified(&ptr->req, best->etag, ETAG_LEN, best->mtime)) {
+        send_not_modified(ptr, best->etag, ETAG_LEN, best->vary);
+        return 1;
+    }
+    best->users++;
+    ptr->asset = best;
+    ptr->file_fd = best->fd;
+    ptr->file_offset = 0;
+    ptr->file_cnt = best->size;
+
+    char *conn = conn_header(ptr);
+    struct iovec *iov = ptr->iov;
+    iov->iov_base = best->headers;
+    iov->iov_len = best->headers_cnt;
+    iov++;
+    if (conn[0]) {
+        iov->iov_base = conn;
+        iov->iov_len = strlen(conn);
+        iov++;
+    }
+    iov->iov_base = "\r\n";
+    iov->iov_len = 2;
+    iov++;
+    ptr->iov_idx = 0;
+    ptr->iov_cnt = iov - ptr->iov;
+    send_response(ptr);
+    return 1;
+}
@@ -3,6 +3,8 @@
 
 #include "main.h"
 #include "rio.h"
+#include "hash.h"
+#include "search.h"
 #include <arpa/inet.h>          /* inet_ntoa */
 #include <dirent.h>
 #include <errno.h>
@@ -15,16 +17,51 @@
 #include <string.h>
 #include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#define MAX_ASSETS 4096         // files under document root
+#define MAX_DEPTH 8             // of directories scanned
+#define MAX_CHANGES 16          // files read again on a change, more rescan
+
 typedef struct {
     const char *extension;
     const char *mime_type;
 } mime_map;
 
-void serve_file(dict_epoll_data *ptr, char *uri);
+// a file under document root, opened and formatted at startup. A .gz
+// or .br sibling is a variant of it
+typedef struct static_asset {
+    char *path;                 // relative, no leading /
+    int fd;                     // kept open, sendfile from
+    off_t size;
+    time_t mtime;
+    const char *mime_type;
+    char *headers;              // status line to last header, not Connection
+    int headers_cnt;
+    char etag[ETAG_LEN + 1];    // of content
+    int vary;                   // has a variant, or is one
+    struct static_asset *variants[ENC_COUNT]; // by ENC_*, [0] is itself
+    int users;                  // responses in flight
+    int stale;                  // table rebuilt, free when users is 0
+} static_asset;
+
+void init_static();
+
+int static_watch_fd();
+
+void static_changed();
+
+int static_asset_count();
+
+long static_reload_count();
+
+int serve_file(dict_epoll_data *ptr, char *uri);
+
+void static_release(dict_epoll_data *ptr);
 
 #endif /* _STATIC_H_ */
@@ -0,0 +1,96 @@
+#include "stats.h"
+
+char *route_names[ROUTE_COUNT] = {
+    "entry", "complete", "suggest", "batch", "static", "stats"
+};
+
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// below HIST_SUB as is, then by the top HIST_SUB_BITS + 1 bits
+static int bucket_of(long v) {
+    if (v < HIST_SUB) {
+        return v < 0 ? 0 : v;
+    }
+    int e = 63 - __builtin_clzl(v); // >= HIST_SUB_BITS
+    if (e > HIST_MAX_EXP) {
+        return HIST_BUCKETS - 1;
+    }
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB +
+        ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// largest value that falls in bucket i
+static long bucket_top(int i) {
+    if (i < HIST_SUB) {
+        return i;
+    }
+    int e = i / HIST_SUB + HIST_SUB_BITS - 1;
+    long sub = HIST_SUB + i % HIST_SUB;
+    return ((sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+// only the worker owning h call it
+void hist_record(histogram *h, long us) {
+    h->buckets[bucket_of(us)]++;
+    h->count++;
+    if (us > h->max) {
+        h->max = us;
+    }
+}
+
+// value p (0 - 1) of the recorded are not above, within 1/8
+long hist_percentile(histogram *h, double p) {
+    long rank = (long)(h->count * p + 0.5), seen = 0;
+    if (rank < 1) { rank = 1; }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            long top = bucket_top(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+// name_us top count, a line for every bucket not empty. Return length,
+// lines that do not fit are left out
+int hist_buckets(histogram *h, char *name, char *buf, int size) {
+    int length = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (h->buckets[i]) {
+            int n = snprintf(buf + length, size - length, "%s_us %ld %ld\n",
+                             name, bucket_top(i), h->buckets[i]);
+            if (n >= size - length) {
+                break;
+            }
+            length += n;
+        }
+    }
+    return length;
+}
+
+// counters of count workers added up. Each is written by its worker
+// only, a relaxed load is enough. max of histograms is the largest
+void stats_sum(worker_stats *total, worker_stats *all, int count) {
+    long *t = (long*)total;
+    memset(total, 0, sizeof(worker_stats));
+    for (int w = 0; w < count; w++) {
+        long *c = (long*)(all + w);
+        for (size_t i = 0; i < sizeof(worker_stats) / sizeof(long); i++) {
+            t[i] += __atomic_load_n(c + i, __ATOMIC_RELAXED);
+        }
+    }
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        total->latency[r].max = 0;
+        for (int w = 0; w < count; w++) {
+            long max = __atomic_load_n(&all[w].latency[r].max, __ATOMIC_RELAXED);
+            if (max > total->latency[r].max) {
+                total->latency[r].max = max;
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "search.h"
+
+// what a request is, latency is kept by it
+#define ROUTE_ENTRY 0           // /d/
+#define ROUTE_COMPLETE 1        // /p/
+#define ROUTE_SUGGEST 2         // /s/
+#define ROUTE_BATCH 3           // /b/
+#define ROUTE_STATIC 4
+#define ROUTE_STATS 5
+#define ROUTE_COUNT 6
+
+// HDR style: 8 linear sub buckets per power of 2, 1/8 relative error.
+// Values are microseconds, up to 2^34, about 4.7 hours
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 34
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB)
+
+typedef struct {
+    long count;
+    long max;                   // microseconds
+    long buckets[HIST_BUCKETS];
+} histogram;
+
+// counters of a worker, only it write them. Those of all workers are
+// in one shared mapping, made before fork or threads, /stats add them
+// up without lock. All long: added up as an array. A cache line of
+// its own each
+typedef struct {
+    long requests, loop_waits;  // epoll_wait or io_uring_enter
+    long accept_total, accept_shed;
+    long route_requests[ROUTE_COUNT];
+    long entry_hit, entry_miss; // /d/ word found or not
+    long batch_hit, batch_miss; // words of /b/
+    long static_hit, static_miss;
+    long error_4xx, error_5xx;
+    long bytes_in, bytes_out;
+    long partial_writes;        // socket took less than given
+    long write_eagain;          // socket full, wait for it
+    long entry_copy, entry_copy_bytes; // /d/ bodies, by how sent
+    long entry_sendfile, entry_sendfile_bytes;
+    long entry_sent[ENC_COUNT], entry_inflated; // by content coding
+    long not_modified;          // 304 sent
+    long timeout_count[4];      // by TIMER_*
+    long log_dropped;           // log ring was full
+    long access_records;        // written to the access log
+    histogram latency[ROUTE_COUNT]; // request parsed to response written
+} __attribute__((aligned(64))) worker_stats;
+
+extern char *route_names[ROUTE_COUNT];
+
+uint64_t now_us();
+
+void hist_record(histogram *h, long us);
+
+long hist_percentile(histogram *h, double p);
+
+int hist_buckets(histogram *h, char *name, char *buf, int size);
+
+void stats_sum(worker_stats *total, worker_stats *all, int count);
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,200 @@
+#include "suggest.h"
+#include "complete.h"
+#include "dictdb.h"
+#include "log.h"
+
+#define MAX_WORD (MAX_QUERY + MAX_DISTANCE) // longer can not be suggested
+#define BUCKETS (1 << BUCKET_BITS)
+
+static __thread uint32_t *seen; // stamp per word, dedupe candidates
+static __thread int seen_cnt;   // words it has room for
+static __thread uint32_t stamp; // each thread its own
+
+// FNV-1a of word without byte i and j, -1 for none
+static uint32_t hash_deleted(const char *word, int length, int i, int j) {
+    uint32_t h = 2166136261u;
+    for (int k = 0; k < length; k++) {
+        if (k != i && k != j) {
+            h ^= (unsigned char)word[k];
+            h *= 16777619u;
+        }
+    }
+    return h;
+}
+
+static inline uint32_t bucket_of(uint32_t hash) {
+    return (hash * 2654435761u) >> (32 - BUCKET_BITS);
+}
+
+// hash of every distinct way to delete 0, 1 or 2 bytes. Of a run of
+// same byte, only the first is deleted. Return how many
+static int deletes(const char *w, int length, uint32_t *hashes) {
+    int n = 0;
+    hashes[n++] = hash_deleted(w, length, -1, -1);
+    for (int i = 0; i < length; i++) {
+        if (i > 0 && w[i] == w[i - 1]) { continue; }
+        hashes[n++] = hash_deleted(w, length, i, -1);
+        for (int j = i + 1; j < length; j++) {
+            if (j - 1 != i && w[j] == w[j - 1]) { continue; }
+            hashes[n++] = hash_deleted(w, length, i, j);
+        }
+    }
+    return n;
+}
+
+#define MAX_DELETES (1 + MAX_WORD + MAX_WORD * (MAX_WORD - 1) / 2)
+
+// optimal string alignment distance, or MAX_DISTANCE + 1 if more
+static int distance(const char *a, int la, const char *b, int lb) {
+    int rows[3][MAX_WORD + 1];
+    int *prev2 = rows[0], *prev = rows[1], *cur = rows[2];
+    if (abs(la - lb) > MAX_DISTANCE) {
+        return MAX_DISTANCE + 1;
+    }
+    for (int j = 0; j <= lb; j++) { prev[j] = j; }
+    for (int i = 1; i <= la; i++) {
+        int row_min = cur[0] = i;
+        for (int j = 1; j <= lb; j++) {
+            int cost = a[i - 1] != b[j - 1];
+            int d = prev[j - 1] + cost;
+            if (prev[j] + 1 < d) { d = prev[j] + 1; }
+            if (cur[j - 1] + 1 < d) { d = cur[j - 1] + 1; }
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]
+                && prev2[j - 2] + 1 < d) {
+                d = prev2[j - 2] + 1;
+            }
+            cur[j] = d;
+            if (d < row_min) { row_min = d; }
+        }
+        if (row_min > MAX_DISTANCE) {
+            return MAX_DISTANCE + 1;
+        }
+        int *t = prev2; prev2 = prev; prev = cur; cur = t;
+    }
+    return prev[lb] > MAX_DISTANCE ? MAX_DISTANCE + 1 : prev[lb];
+}
+
+// counting sort by bucket: count, then place, deletes made twice.
+// Into db of the calling thread. -1 if out of memory
+int init_suggest() {
+    static uint32_t hashes[MAX_DELETES];
+    int total = word_total();
+    uint32_t *buckets = resident_alloc(sizeof(uint32_t) * (BUCKETS + 1));
+    if (!buckets) {
+        perror("resident_alloc");
+        return -1;
+    }
+    db->suggest.buckets = buckets;
+    memset(buckets, 0, sizeof(uint32_t) * (BUCKETS + 1));
+    for (int i = 0; i < total; i++) {
+        char *w = word_at(i);
+        int length = strlen(w);
+        if (length > MAX_WORD) { continue; }
+        int n = deletes(w, length, hashes);
+        for (int k = 0; k < n; k++) {
+            buckets[bucket_of(hashes[k]) + 1]++;
+        }
+    }
+    for (int b = 0; b < BUCKETS; b++) {
+        buckets[b + 1] += buckets[b];
+    }
+    uint32_t entry_count = buckets[BUCKETS];
+    delete_entry *entries = resident_alloc(sizeof(delete_entry) * entry_count);
+    uint32_t *fill = malloc(sizeof(uint32_t) * BUCKETS);
+    db->suggest.entries = entries;
+    if (!entries || !fill) {
+        perror("resident_alloc");
+        free(fill);
+        return -1;
+    }
+    memcpy(fill, buckets, sizeof(uint32_t) * BUCKETS);
+    for (int i = 0; i < total; i++) {
+        char *w = word_at(i);
+        int length = strlen(w);
+        if (length > MAX_WORD) { continue; }
+        int n = deletes(w, length, hashes);
+        for (int k = 0; k < n; k++) {
+            delete_entry *e = entries + fill[bucket_of(hashes[k])]++;
+            e->hash = hashes[k];
+            e->index = i;
+        }
+    }
+    free(fill);
+    db->suggest.entry_count = entry_count;
+    LOG(LOG_DEBUG, "%ld deletes, %ld bytes", entry_count,
+        sizeof(delete_entry) * entry_count + sizeof(uint32_t) * (BUCKETS + 1));
+    return 0;
+}
+
+void free_suggest(suggest_data *s) {
+    free(s->buckets);
+    free(s->entries);
+}
+
+// a rank before b: closer, more popular, then alphabetical
+static inline int better(int a, int da, int b, int db) {
+    return da < db || (da == db && (word_freq(a) > word_freq(b) ||
+                                    (word_freq(a) == word_freq(b) && a < b)));
+}
+
+// stamps of the calling worker room for words. When it starts, and
+// when a reload bring more words, never in a request. -1 if no memory
+int suggest_reserve(int words) {
+    if (seen_cnt >= words) {
+        return 0;
+    }
+    uint32_t *s = calloc(words, sizeof(uint32_t));
+    if (!s) {
+        return -1;
+    }
+    free(seen);
+    seen = s;
+    seen_cnt = words;
+    stamp = 0;
+    return 0;
+}
+
+// best n words within MAX_DISTANCE of word, their indexes are put in
+// result. Return how many. Nothing is allocated
+int suggest(char *word, int n, int *result) {
+    uint32_t hashes[1 + MAX_QUERY + MAX_QUERY * (MAX_QUERY - 1) / 2];
+    int dist[MAX_SUGGEST];
+    int length = strlen(word), count = 0;
+    uint32_t *buckets = db->suggest.buckets;
+    delete_entry *entries = db->suggest.entries;
+    if (n > MAX_SUGGEST) { n = MAX_SUGGEST; }
+    if (n < 1 || length > MAX_QUERY) { return 0; }
+    if (seen_cnt < word_total()) {
+        return 0;               // suggest_reserve failed
+    }
+    if (++stamp == 0) {         // wrapped, forget all
+        memset(seen, 0, sizeof(uint32_t) * seen_cnt);
+        stamp = 1;
+    }
+    int hash_count = deletes(word, length, hashes);
+    for (int k = 0; k < hash_count; k++) {
+        uint32_t b = bucket_of(hashes[k]);
+        for (uint32_t e = buckets[b]; e < buckets[b + 1]; e++) {
+            uint32_t index = entries[e].index;
+            if (entries[e].hash != hashes[k] || seen[index] == stamp) {
+                continue;
+            }
+            seen[index] = stamp;
+            char *w = word_at(index);
+            int d = distance(word, length, w, strlen(w));
+            if (d > MAX_DISTANCE ||
+                (count == n && !better(index, d, result[n - 1], dist[n - 1]))) {
+                continue;
+            }
+            int i = count < n ? count++ : n - 1;
+            while (i > 0 && better(index, d, result[i - 1], dist[i - 1])) {
+                result[i] = result[i - 1];
+                dist[i] = dist[i - 1];
+                i--;
+            }
+            result[i] = index;
+            dist[i] = d;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,37 @@
+#ifndef _SUGGEST_H_
+#define _SUGGEST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "search.h"
+
+#define MAX_DISTANCE 2          // edit distance, with transposition
+#define MAX_SUGGEST 32          // max suggestions returned
+#define MAX_QUERY 32            // longer words get no suggestion
+#define BUCKET_BITS 18
+
+// SymSpell: every word with up to 2 letters deleted is kept, by hash.
+// Words within distance 2 of a query share at least one such delete
+typedef struct {
+    uint32_t hash;              // of the word with letters deleted
+    uint32_t index;             // of the word
+} delete_entry;
+
+// of a dict_db
+typedef struct {
+    uint32_t *buckets;          // BUCKETS + 1 offsets into entries
+    delete_entry *entries;      // grouped by bucket
+    uint32_t entry_count;
+} suggest_data;
+
+int init_suggest();
+
+void free_suggest(suggest_data *s);
+
+int suggest_reserve(int words);
+
+int suggest(char *word, int n, int *result);
+
+#endif /* _SUGGEST_H_ */
@@ -0,0 +1,118 @@
+#include "timer.h"
+
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+static void list_init(timer_node *head) {
+    head->next = head->prev = head;
+}
+
+static void list_append(timer_node *head, timer_node *n) {
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+// current tick, monotonic
+uint64_t timer_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / TIMER_TICK_MS;
+}
+
+void timer_init(timer_wheel *w) {
+    w->next = timer_now();
+    w->count = 0;
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int i = 0; i < WHEEL_SIZE; i++) {
+            list_init(&w->slots[l][i]);
+        }
+    }
+}
+
+// lowest level whose span hold it
+static void place(timer_wheel *w, timer_node *n) {
+    uint64_t expire = n->expire;
+    if (expire < w->next) {     // already due, run at next tick
+        expire = w->next;
+    }
+    uint64_t delta = expire - w->next;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS))) { // clamp
+        expire = w->next + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+        n->expire = expire;
+    }
+    int slot = (expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    list_append(&w->slots[level][slot], n);
+}
+
+void timer_add(timer_wheel *w, timer_node *n, uint64_t expire) {
+    if (n->next) {
+        timer_del(w, n);
+    }
+    n->expire = expire;
+    place(w, n);
+    w->count++;
+}
+
+void timer_del(timer_wheel *w, timer_node *n) {
+    if (n->next) {
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+        n->next = n->prev = NULL;
+        w->count--;
+    }
+}
+
+// move timers of a slot to lower levels, return the slot index
+static int cascade(timer_wheel *w, int level) {
+    int slot = (w->next >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer_node *head = &w->slots[level][slot], *n = head->next;
+    list_init(head);
+    while (n != head) {
+        timer_node *next = n->next;
+        place(w, n);
+        n = next;
+    }
+    return slot;
+}
+
+// run ticks up to now, expired timers are unlinked and appended to
+// expired, a list head. Caller handle them in one batch
+void timer_advance(timer_wheel *w, uint64_t now, timer_node *expired) {
+    list_init(expired);
+    if (w->count == 0) {        // nothing to move, jump
+        w->next = now + 1 > w->next ? now + 1 : w->next;
+        return;
+    }
+    while (w->next <= now) {
+        int slot = w->next & WHEEL_MASK;
+        for (int l = 1; slot == 0 && l < WHEEL_LEVELS; l++) {
+            slot = cascade(w, l);
+        }
+        slot = w->next & WHEEL_MASK;
+        timer_node *head = &w->slots[0][slot];
+        while (head->next != head) {
+            timer_node *n = head->next;
+            timer_del(w, n);
+            list_append(expired, n);
+        }
+        w->next++;
+    }
+}
+
+// first of a list from timer_advance, unlinked. NULL if empty
+timer_node* timer_pop(timer_node *list) {
+    timer_node *n = list->next;
+    if (n == list) {
+        return NULL;
+    }
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = n->prev = NULL;
+    return n;
+}
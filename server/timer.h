@@ -0,0 +1,41 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TIMER_TICK_MS 100       // resolution
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS) // slots a level
+#define WHEEL_LEVELS 4          // 64^4 ticks, about 19 days
+
+// in a doubly linked slot list, add and delete are O(1). Embedded in
+// what it times, no allocation
+typedef struct timer_node {
+    struct timer_node *next, *prev; // NULL if not armed
+    uint64_t expire;            // tick
+} timer_node;
+
+// hierarchical: level n slot cover 64^n ticks. Timers of a higher level
+// slot are moved down when the lower level wraps
+typedef struct {
+    uint64_t next;              // next tick to run
+    int count;                  // timers armed
+    timer_node slots[WHEEL_LEVELS][WHEEL_SIZE]; // list heads
+} timer_wheel;
+
+uint64_t timer_now();
+
+void timer_init(timer_wheel *w);
+
+void timer_add(timer_wheel *w, timer_node *n, uint64_t expire);
+
+void timer_del(timer_wheel *w, timer_node *n);
+
+void timer_advance(timer_wheel *w, uint64_t now, timer_node *expired);
+
+timer_node* timer_pop(timer_node *list);
+
+#endif /* _TIMER_H_ */
@@ -0,0 +1,160 @@
+#include "uring.h"
+
+static int uring_enter(uring *r, unsigned to_submit, unsigned min_complete,
+                       unsigned flags, void *arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+                   flags, arg, argsz);
+}
+
+// -1 and errno if the kernel has no io_uring, or not allowed
+int uring_init(uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(r, 0, sizeof(uring));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 2;
+    // one thread submit, completions run when it wait: 6.1+
+    p.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0 && errno == EINVAL) {
+        p.flags &= ~(IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+        r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (r->fd < 0) {
+        return -1;
+    }
+    // a wait with a timeout, or the timer wheel never turn: 5.11+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    char *ring = mmap(NULL, sq_size > cq_size ? sq_size : cq_size,
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->fd, IORING_OFF_SQ_RING);
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned*)(ring + p.sq_off.head);
+    r->sq_tail = (unsigned*)(ring + p.sq_off.tail);
+    r->sq_mask = *(unsigned*)(ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(ring + p.sq_off.array);
+    r->cq_head = (unsigned*)(ring + p.cq_off.head);
+    r->cq_tail = (unsigned*)(ring + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)(ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+    r->sqe_tail = *r->sq_tail;
+    for (unsigned i = 0; i < r->sq_entries; i++) {
+        r->sq_array[i] = i;     // sqe i is always slot i
+    }
+    return 0;
+}
+
+// count buffers of size bytes in a ring of group: recv with
+// IOSQE_BUFFER_SELECT take one only when bytes come, so an idle socket
+// hold none. count is a power of 2. -1 if the kernel can not: 5.19+
+int uring_provide_buffers(uring *r, int group, int count, int size) {
+    struct io_uring_buf_reg reg;
+    size_t ring_size = count * sizeof(struct io_uring_buf);
+    r->buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->bufs = mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->buf_ring == MAP_FAILED || r->bufs == MAP_FAILED) {
+        return -1;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)r->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+        return -1;
+    }
+    r->buf_size = size;
+    r->buf_mask = count - 1;
+    r->buf_tail = 0;
+    for (int i = 0; i < count; i++) {
+        uring_recycle(r, i);
+    }
+    return 0;
+}
+
+char* uring_buffer(uring *r, int bid) {
+    return r->bufs + (size_t)bid * r->buf_size;
+}
+
+// give buffer bid back to the kernel
+void uring_recycle(uring *r, int bid) {
+    struct io_uring_buf *b = r->buf_ring->bufs + (r->buf_tail & r->buf_mask);
+    b->addr = (unsigned long)uring_buffer(r, bid);
+    b->len = r->buf_size;
+    b->bid = bid;
+    __atomic_store_n(&r->buf_ring->tail, ++r->buf_tail, __ATOMIC_RELEASE);
+}
+
+// zeroed sqe, submitted with the next uring_submit_and_wait. If the
+// queue is full, what is in it is submitted now
+struct io_uring_sqe* uring_get_sqe(uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head == r->sq_entries) {
+        __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+        uring_enter(r, r->sqe_tail - head, 0, 0, NULL, 0);
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sqe_tail - head == r->sq_entries) {
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = r->sqes + (r->sqe_tail++ & r->sq_mask);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+// submit all, wait for at least one completion, or wait_ms, -1 is
+// forever. One syscall for both
+int uring_submit_and_wait(uring *r, int wait_ms) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    void *argp = NULL;
+    size_t argsz = 0;
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    if (wait_ms >= 0) {
+        ts.tv_sec = wait_ms / 1000;
+        ts.tv_nsec = (wait_ms % 1000) * 1000000L;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    // sqes the kernel has not taken, as when it was busy last time
+    unsigned pending = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    int n = uring_enter(r, pending, 1, flags, argp, argsz);
+    if (n < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY)) {
+        n = 0;                  // nothing done in time, or try again
+    }
+    return n;
+}
+
+// next completion, NULL if none
+struct io_uring_cqe* uring_peek_cqe(uring *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return r->cqes + (head & r->cq_mask);
+}
+
+void uring_cqe_seen(uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
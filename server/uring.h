@@ -0,0 +1,49 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+// an io_uring, by the raw syscalls. One per worker, only its thread
+// use it
+typedef struct {
+    int fd;
+    unsigned sq_entries, sq_mask, cq_mask;
+    unsigned *sq_head, *sq_tail, *sq_array;
+    unsigned *cq_head, *cq_tail;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail;          // next sqe to fill
+
+    // provided buffers, recv pick one when bytes come
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;
+    int buf_size;
+    unsigned buf_mask;
+    unsigned short buf_tail;
+} uring;
+
+int uring_init(uring *r, unsigned entries);
+
+int uring_provide_buffers(uring *r, int group, int count, int size);
+
+struct io_uring_sqe* uring_get_sqe(uring *r);
+
+int uring_submit_and_wait(uring *r, int wait_ms);
+
+struct io_uring_cqe* uring_peek_cqe(uring *r);
+
+void uring_cqe_seen(uring *r);
+
+char* uring_buffer(uring *r, int bid);
+
+void uring_recycle(uring *r, int bid);
+
+#endif /* _URING_H_ */
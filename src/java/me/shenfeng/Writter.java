@@ -1,6 +1,7 @@
 package me.shenfeng;
 
 import java.io.BufferedWriter;
+import java.io.ByteArrayOutputStream;
 import java.io.File;
 import java.io.FileInputStream;
 import java.io.FileNotFoundException;
@@ -8,6 +9,8 @@ import java.io.FileOutputStream;
 import java.io.FileWriter;
 import java.io.IOException;
 import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.sql.Connection;
 import java.sql.DriverManager;
 import java.sql.PreparedStatement;
@@ -142,17 +145,24 @@ public class Writter {
         return maps;
     }
 
+    // v2 dbdata, see README. little-endian, so the server can use it as is
+    public static final byte[] MAGIC = "DICTDB".getBytes();
+    public static final int VERSION = 2;
+    public static final int HEADER_SIZE = 16;
+    public static final int GZIPPED = 1;
+
     public static void write(Map<String, List<DictItem>> items, IFn toJsonStr)
             throws IOException, SQLException {
-        FileOutputStream fs = new FileOutputStream("/tmp/dbdata");
         int count = items.size();
-        fs.write(getBytes(count)); // how many words
+        int[] offsets = new int[count];
+        ByteArrayOutputStream entries = new ByteArrayOutputStream();
 
         Connection con = DriverManager.getConnection("jdbc:mysql://192.168.1.101/dictionary",
                 "feng", "");
         
         PreparedStatement ps = con.prepareStatement("insert into words (word, meaning) values (?, ?)");
 
+        int i = 0;
         for (Map.Entry<String, List<DictItem>> entry : items.entrySet()) {
             String word = entry.getKey();
             List<DictItem> ds = entry.getValue();
@@ -166,22 +176,52 @@ public class Writter {
             ps.setString(1, word);
             ps.setString(2, json);
             ps.executeUpdate();
-            
-            fs.write(word.getBytes());
-            fs.write(0); // NULL terminate String@
+
+            offsets[i++] = HEADER_SIZE + entries.size();
+            entries.write(word.getBytes());
+            entries.write(0); // NULL terminate String@
             byte[] bytes = json.getBytes();
             byte[] gzipped = Zipper.zip2(json, Deflater.BEST_COMPRESSION);
             if (bytes.length < gzipped.length) {
-                fs.write(getBytes(bytes.length + 0xe000)); // unzipped
-                fs.write(bytes);
+                entries.write(0); // unzipped
+                entries.write(getIntLE(bytes.length));
+                entries.write(bytes);
             } else {
-                fs.write(getBytes(gzipped.length));
-                fs.write(gzipped);
+                entries.write(GZIPPED);
+                entries.write(getIntLE(gzipped.length));
+                entries.write(gzipped);
             }
         }
+        int padding = (4 - entries.size() % 4) % 4; // align the index
+        int indexOffset = HEADER_SIZE + entries.size() + padding;
+
+        ByteBuffer header = ByteBuffer.allocate(HEADER_SIZE).order(ByteOrder.LITTLE_ENDIAN);
+        header.put(MAGIC);
+        header.putShort((short) VERSION);
+        header.putInt(count); // how many words
+        header.putInt(indexOffset);
+
+        ByteBuffer index = ByteBuffer.allocate(4 * count).order(ByteOrder.LITTLE_ENDIAN);
+        for (int offset : offsets) {
+            index.putInt(offset);
+        }
+
+        FileOutputStream fs = new FileOutputStream("/tmp/dbdata");
+        fs.write(header.array());
+        entries.writeTo(fs);
+        fs.write(new byte[padding]);
+        fs.write(index.array());
         fs.close();
     }
 
+    public static byte[] getIntLE(int i) {
+        return ByteBuffer.allocate(4).order(ByteOrder.LITTLE_ENDIAN).putInt(i).array();
+    }
+
+    public static int getIntLE(byte[] bytes, int offset) {
+        return ByteBuffer.wrap(bytes, offset, 4).order(ByteOrder.LITTLE_ENDIAN).getInt();
+    }
+
     public static int getUnsigned(byte b) {
         if (b >= 0)
             return b;
@@ -207,11 +247,12 @@ public class Writter {
         RandomAccessFile ra = new RandomAccessFile("/tmp/dbdata", "r");
         byte bytes[] = new byte[(int) ra.length()];
         ra.readFully(bytes);
-        int index = 2;
+        int indexOffset = getIntLE(bytes, 12); // entries end here
+        int index = HEADER_SIZE;
         byte buffer[] = new byte[1024 * 128];
         int b = 0;
         List<String> list = new ArrayList<String>(50000);
-        while (index < bytes.length) {
+        while (index < indexOffset) {
             int i = 0;
             while (true) {
                 b = bytes[index++];
@@ -224,8 +265,10 @@ public class Writter {
             String word = new String(buffer, 0, i);
             list.add(word);
 
+            boolean gzipped = (bytes[index] & GZIPPED) != 0;
+            index += 1; // flags
             if (word.equals("aa")) {
-                int size = getShort(bytes, index);
+                int size = getIntLE(bytes, index);
                 System.out.println("offset is " + index);
 
                 byte[] header = Extrator.header;
@@ -235,7 +278,7 @@ public class Writter {
                 }
 
                 for (int j = 0; j < size; ++j) {
-                    buffer2[j + header.length] = bytes[j + index + 2];
+                    buffer2[j + header.length] = bytes[j + index + 4];
                 }
                 for (int j = 0; j < buffer2.length; j++) {
                     if (j % 16 == 0) {
@@ -251,11 +294,12 @@ public class Writter {
 
             // System.out.println(word);
 
-            int size = getShort(bytes, index);
+            int size = getIntLE(bytes, index);
             System.out.println(word + "\t" + size + "\t" + index);
 
-            index += 2;
-            String str = Zipper.unzip(bytes, index, size);
+            index += 4;
+            String str = gzipped ? Zipper.unzip(bytes, index, size) : new String(bytes,
+                    index, size);
             System.out.println(str);
             index += size;
         }